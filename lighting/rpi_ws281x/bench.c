@@ -0,0 +1,1245 @@
+/*
+ * bench.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Host side micro-benchmarks for the CPU bound parts of the driver.  Nothing
+ * here touches the hardware, so this builds and runs on any Linux machine:
+ *
+ *     gcc -O2 -o bench bench.c encode.c stream.c trace.c layout.c compose.c -lm && ./bench [name ...]
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ws2811.h"
+#include "encode.h"
+#include "stream.h"
+#include "trace.h"
+#include "layout.h"
+#include "compose.h"
+
+
+#define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
+
+#define BENCH_MIN_NS                             200000000ULL   // Run each case for at least 200ms
+
+#define STREAM_FRAMES                            600            // 10 seconds at 60 fps
+#define STREAM_COMET_LEDS                        20
+
+#define TRACE_BENCH_EVENTS                       1000000
+
+#define LAYOUT_PANEL                             16             // LEDs across one panel
+#define LAYOUT_TILES                             4              // Panels across the framebuffer
+
+#define COMPOSE_LAYERS                           6
+
+// Words needed by one channel, plus one so a trailing partial word is in range
+#define CHANNEL_WORDS(leds)                      ((((leds) * 3 * 8 * 3) / 32) + 1)
+
+
+static const int led_counts[] = { 64, 300, 1024, 4096 };
+
+// Color correction for the channels set up by fake_init()
+static encode_lut_t fake_lut[RPI_PWM_CHANNELS];
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Fill in a ws2811_t as ws2811_init() would, without the hardware, and give
+ * every LED a pseudo random color.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    count   Number of LEDs on channel 0, channel 1 gets a quarter of that.
+ *
+ * @returns  None
+ */
+static void fake_init(ws2811_t *ws2811, int count)
+{
+    int chan, i;
+
+    memset(ws2811, 0, sizeof(*ws2811));
+    ws2811->freq = WS2811_TARGET_FREQ;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+
+        channel->count = chan ? count / 4 : count;
+        channel->brightness = chan ? 96 : 255;
+        channel->strip_type = chan ? WS2811_STRIP_RGB : WS2811_STRIP_GRB;
+        channel->leds = malloc(sizeof(ws2811_led_t) * (channel->count + 1));
+
+        for (i = 0; i < channel->count; i++)
+        {
+            channel->leds[i] = rand() & 0xffffff;
+        }
+
+        encode_lut_build(&fake_lut[chan], channel->strip_type, channel->brightness,
+                         channel->gamma, channel->white_balance);
+    }
+}
+
+static void fake_fini(ws2811_t *ws2811)
+{
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        free(ws2811->channel[chan].leds);
+    }
+}
+
+static uint32_t *frame_alloc(ws2811_t *ws2811)
+{
+    int words = CHANNEL_WORDS(ws2811->channel[0].count) * RPI_PWM_CHANNELS;
+
+    return calloc(words, sizeof(uint32_t));
+}
+
+static size_t frame_size(ws2811_t *ws2811)
+{
+    return CHANNEL_WORDS(ws2811->channel[0].count) * RPI_PWM_CHANNELS * sizeof(uint32_t);
+}
+
+
+/*
+ * The original bit at a time encoder from ws2811_render(), kept as the
+ * reference the table encoder is checked and timed against.  The bit cursor
+ * starts over for each channel, so each channel begins on a word boundary.
+ */
+static void legacy_render(ws2811_t *ws2811, uint32_t *pwm_raw)
+{
+    int i, k, l, chan;
+    unsigned j;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)         // Channel
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        int bitpos = 31;
+        int wordpos = chan;
+        int scale   = (channel->brightness & 0xff) + 1;
+        int rshift  = (channel->strip_type >> 16) & 0xff;
+        int gshift  = (channel->strip_type >> 8)  & 0xff;
+        int bshift  = (channel->strip_type >> 0)  & 0xff;
+
+        for (i = 0; i < channel->count; i++)                // Led
+        {
+            uint8_t color[] =
+            {
+                (((channel->leds[i] >> rshift) & 0xff) * scale) >> 8, // red
+                (((channel->leds[i] >> gshift) & 0xff) * scale) >> 8, // green
+                (((channel->leds[i] >> bshift) & 0xff) * scale) >> 8, // blue
+            };
+
+            for (j = 0; j < ARRAY_SIZE(color); j++)        // Color
+            {
+                for (k = 7; k >= 0; k--)                   // Bit
+                {
+                    uint8_t symbol = SYMBOL_LOW;
+
+                    if (color[j] & (1 << k))
+                    {
+                        symbol = SYMBOL_HIGH;
+                    }
+
+                    for (l = 2; l >= 0; l--)               // Symbol
+                    {
+                        uint32_t *wordptr = &pwm_raw[wordpos];
+
+                        *wordptr &= ~(1 << bitpos);
+                        if (symbol & (1 << l))
+                        {
+                            *wordptr |= (1 << bitpos);
+                        }
+
+                        bitpos--;
+                        if (bitpos < 0)
+                        {
+                            // Every other word is on the same channel
+                            wordpos += 2;
+
+                            bitpos = 31;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+static void channel_render(ws2811_t *ws2811, uint32_t *pwm_raw)
+{
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+
+        encode_channel(channel, &fake_lut[chan], &pwm_raw[chan], RPI_PWM_CHANNELS,
+                       0, channel->count);
+    }
+}
+
+static void table_render(ws2811_t *ws2811, uint32_t *pwm_raw)
+{
+    int count = ws2811->channel[0].count;
+
+    if (ws2811->channel[1].count > count)
+    {
+        count = ws2811->channel[1].count;
+    }
+
+    encode_channels(ws2811->channel, fake_lut, pwm_raw, 0, count);
+}
+
+static void aligned_render(ws2811_t *ws2811, uint32_t *pwm_raw)
+{
+    int count = ws2811->channel[0].count;
+
+    if (ws2811->channel[1].count > count)
+    {
+        count = ws2811->channel[1].count;
+    }
+
+    encode_channels4(ws2811->channel, fake_lut, pwm_raw, 0, count);
+}
+
+/**
+ * Bit at a time reference for the word aligned mode, checks the output of
+ * aligned_render().
+ *
+ * @returns  0 if the output matches, -1 otherwise.
+ */
+static int aligned_check(ws2811_t *ws2811, const uint32_t *pwm_raw)
+{
+    int chan, i, j, k;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        int shift[3] =
+        {
+            (channel->strip_type >> 16) & 0xff,
+            (channel->strip_type >> 8) & 0xff,
+            channel->strip_type & 0xff,
+        };
+
+        for (i = 0; i < channel->count; i++)
+        {
+            for (j = 0; j < 3; j++)
+            {
+                uint8_t color = fake_lut[chan].color[j][(channel->leds[i] >> shift[j]) & 0xff];
+                uint32_t word = 0;
+
+                for (k = 7; k >= 0; k--)
+                {
+                    word = (word << 4) | ((color & (1 << k)) ? SYMBOL4_HIGH : SYMBOL4_LOW);
+                }
+
+                if (pwm_raw[(((i * 3) + j) * RPI_PWM_CHANNELS) + chan] != word)
+                {
+                    return -1;
+                }
+            }
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Time a render function over the given instance.
+ *
+ * @returns  Nanoseconds per LED, averaged over all channels.
+ */
+static double time_render(ws2811_t *ws2811, uint32_t *pwm_raw,
+                          void (*render)(ws2811_t *, uint32_t *))
+{
+    int leds = ws2811->channel[0].count + ws2811->channel[1].count;
+    uint64_t start, elapsed;
+    unsigned iterations = 0;
+
+    start = now_ns();
+    do
+    {
+        render(ws2811, pwm_raw);
+        iterations++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    return (double)elapsed / ((double)iterations * leds);
+}
+
+
+/*
+ * Benchmarks
+ */
+
+
+static int bench_encode(void)
+{
+    unsigned i;
+    int ret = 0;
+
+    printf("%8s %14s %14s %8s\n", "leds", "legacy ns/led", "table ns/led", "speedup");
+
+    for (i = 0; i < ARRAY_SIZE(led_counts); i++)
+    {
+        ws2811_t ws2811;
+        uint32_t *expect, *actual;
+        double legacy, table;
+
+        fake_init(&ws2811, led_counts[i]);
+        expect = frame_alloc(&ws2811);
+        actual = frame_alloc(&ws2811);
+
+        legacy_render(&ws2811, expect);
+        table_render(&ws2811, actual);
+        if (memcmp(expect, actual, frame_size(&ws2811)))
+        {
+            fprintf(stderr, "encode: output mismatch with %d leds\n", led_counts[i]);
+            ret = -1;
+        }
+
+        legacy = time_render(&ws2811, expect, legacy_render);
+        table = time_render(&ws2811, actual, table_render);
+
+        printf("%8d %14.2f %14.2f %7.1fx\n", led_counts[i], legacy, table, legacy / table);
+
+        free(expect);
+        free(actual);
+        fake_fini(&ws2811);
+    }
+
+    return ret;
+}
+
+static int bench_kernels(void)
+{
+    const encode_kernel_t *kernel;
+    int count = led_counts[ARRAY_SIZE(led_counts) - 1];
+    int nbytes = count * 3;
+    uint8_t *bytes = malloc(nbytes);
+    uint32_t *expect = malloc(ENCODE_WORDS(nbytes) * sizeof(uint32_t));
+    uint32_t *actual = malloc(ENCODE_WORDS(nbytes) * sizeof(uint32_t));
+    double scalar = 0;
+    int i, ret = 0;
+
+    for (i = 0; i < nbytes; i++)
+    {
+        bytes[i] = rand();
+    }
+
+    printf("%8s %10s %12s %8s\n", "kernel", "checked", "ns/led", "speedup");
+
+    for (kernel = encode_kernels; kernel->name; kernel++)
+    {
+        uint64_t start, elapsed;
+        unsigned iterations = 0;
+        int checked = 0;
+        double ns;
+
+        if (!kernel->supported())
+        {
+            printf("%8s %10s\n", kernel->name, "n/a");
+            continue;
+        }
+
+        // Random lengths and contents against the scalar kernel
+        for (i = 0; i < 1000; i++)
+        {
+            int len = (rand() % 256) * 4;
+            int j;
+
+            for (j = 0; j < len; j++)
+            {
+                bytes[j] = rand();
+            }
+
+            encode_kernels[0].expand(expect, bytes, len);
+            memset(actual, 0xa5, ENCODE_WORDS(len + 4) * sizeof(uint32_t));
+            kernel->expand(actual, bytes, len);
+
+            if (memcmp(expect, actual, ENCODE_WORDS(len) * sizeof(uint32_t)) ||
+                (actual[ENCODE_WORDS(len)] != 0xa5a5a5a5))
+            {
+                fprintf(stderr, "kernels: %s mismatch with %d bytes\n", kernel->name, len);
+                ret = -1;
+                break;
+            }
+            checked++;
+        }
+
+        // Whole channels against the reference encoder, including partial chunks
+        encode_kernel_set(kernel);
+        for (i = 0; i < 200; i++)
+        {
+            ws2811_t ws2811;
+            uint32_t *ref, *enc;
+
+            fake_init(&ws2811, 1 + (rand() % 700));
+            ref = frame_alloc(&ws2811);
+            enc = frame_alloc(&ws2811);
+
+            legacy_render(&ws2811, ref);
+            table_render(&ws2811, enc);
+            if (memcmp(ref, enc, frame_size(&ws2811)))
+            {
+                fprintf(stderr, "kernels: %s channel mismatch with %d leds\n", kernel->name,
+                        ws2811.channel[0].count);
+                ret = -1;
+            }
+            else
+            {
+                checked++;
+            }
+
+            free(ref);
+            free(enc);
+            fake_fini(&ws2811);
+        }
+        encode_kernel_set(&encode_kernels[0]);
+
+        start = now_ns();
+        do
+        {
+            kernel->expand(actual, bytes, nbytes);
+            iterations++;
+            elapsed = now_ns() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        ns = (double)elapsed / ((double)iterations * count);
+        if (kernel == encode_kernels)
+        {
+            scalar = ns;
+        }
+
+        printf("%8s %10d %12.3f %7.1fx\n", kernel->name, checked, ns, scalar / ns);
+    }
+
+    printf("selected: %s\n", encode_kernel_detect()->name);
+    encode_kernel_set(&encode_kernels[0]);
+
+    free(bytes);
+    free(expect);
+    free(actual);
+
+    return ret;
+}
+
+static int bench_interleave(void)
+{
+    unsigned i;
+    int ret = 0;
+
+    printf("%8s %14s %14s %8s\n", "leds", "2 pass ns/led", "1 pass ns/led", "speedup");
+
+    for (i = 0; i < ARRAY_SIZE(led_counts); i++)
+    {
+        ws2811_t ws2811;
+        uint32_t *expect, *actual;
+        double split, single;
+
+        fake_init(&ws2811, led_counts[i]);
+        expect = frame_alloc(&ws2811);
+        actual = frame_alloc(&ws2811);
+
+        channel_render(&ws2811, expect);
+        table_render(&ws2811, actual);
+        if (memcmp(expect, actual, frame_size(&ws2811)))
+        {
+            fprintf(stderr, "interleave: output mismatch with %d leds\n", led_counts[i]);
+            ret = -1;
+        }
+
+        split = time_render(&ws2811, expect, channel_render);
+        single = time_render(&ws2811, actual, table_render);
+
+        printf("%8d %14.2f %14.2f %7.1fx\n", led_counts[i], split, single, split / single);
+
+        free(expect);
+        free(actual);
+        fake_fini(&ws2811);
+    }
+
+    return ret;
+}
+
+static int bench_symbols(void)
+{
+    unsigned i;
+    int ret = 0;
+
+    // Compare against the kernel the driver would pick
+    printf("3 symbol kernel: %s\n", encode_kernel_detect()->name);
+    printf("%8s %14s %14s %8s %14s\n", "leds", "3 sym ns/led", "4 sym ns/led", "speedup",
+           "bytes 3/4 sym");
+
+    for (i = 0; i < ARRAY_SIZE(led_counts); i++)
+    {
+        ws2811_t ws2811;
+        uint32_t *three, *four;
+        size_t three_size, four_size;
+        double three_ns, four_ns;
+
+        fake_init(&ws2811, led_counts[i]);
+        three = frame_alloc(&ws2811);
+        three_size = frame_size(&ws2811);
+        four_size = led_counts[i] * 3 * RPI_PWM_CHANNELS * sizeof(uint32_t);
+        four = calloc(1, four_size);
+
+        aligned_render(&ws2811, four);
+        if (aligned_check(&ws2811, four))
+        {
+            fprintf(stderr, "symbols: output mismatch with %d leds\n", led_counts[i]);
+            ret = -1;
+        }
+
+        three_ns = time_render(&ws2811, three, table_render);
+        four_ns = time_render(&ws2811, four, aligned_render);
+
+        printf("%8d %14.2f %14.2f %7.1fx %7zu/%zu\n", led_counts[i], three_ns, four_ns,
+               three_ns / four_ns, three_size, four_size);
+
+        free(three);
+        free(four);
+        fake_fini(&ws2811);
+    }
+
+    encode_kernel_set(&encode_kernels[0]);
+
+    return ret;
+}
+
+/**
+ * Time encoding a channel with a given table, in one mode.
+ *
+ * @returns  Nanoseconds per LED.
+ */
+static double time_orders(ws2811_channel_t *channel, const encode_lut_t *lut,
+                          uint32_t *words, int symbols)
+{
+    uint64_t start, elapsed;
+    unsigned iterations = 0;
+
+    start = now_ns();
+    do
+    {
+        if (symbols == WS2811_SYMBOLS_ALIGNED)
+        {
+            encode_channel4(channel, lut, words, 0, channel->count);
+        }
+        else
+        {
+            encode_channel(channel, lut, words, 1, 0, channel->count);
+        }
+        iterations++;
+        elapsed = now_ns() - start;
+    } while (elapsed < BENCH_MIN_NS);
+
+    return (double)elapsed / ((double)iterations * channel->count);
+}
+
+/**
+ * Encode a channel of every strip type, at full and reduced brightness, with the
+ * shifts worked out at run time and with the gather specialized for the strip type,
+ * and check both agree.
+ */
+static int bench_orders(void)
+{
+    static const struct
+    {
+        const char *name;
+        int strip_type;
+    } orders[] =
+    {
+        { "rgb", WS2811_STRIP_RGB }, { "rbg", WS2811_STRIP_RBG },
+        { "grb", WS2811_STRIP_GRB }, { "gbr", WS2811_STRIP_GBR },
+        { "brg", WS2811_STRIP_BRG }, { "bgr", WS2811_STRIP_BGR },
+    };
+    static const int brightness[] = { 255, 128 };
+    int count = led_counts[ARRAY_SIZE(led_counts) - 1];
+    size_t size = count * 3 * sizeof(uint32_t);
+    uint32_t *expect, *actual;
+    ws2811_channel_t channel;
+    unsigned i, b;
+    int symbols, ret = 0;
+
+    encode_kernel_detect();
+    printf("%d leds\n", count);
+    printf("%6s %6s %8s %12s %14s %14s %8s\n", "order", "bright", "symbols", "encoder",
+           "shift ns/led", "fixed ns/led", "speedup");
+
+    memset(&channel, 0, sizeof(channel));
+    channel.count = count;
+    channel.leds = malloc(count * sizeof(ws2811_led_t));
+    for (i = 0; i < count; i++)
+    {
+        channel.leds[i] = rand() & 0xffffff;
+    }
+    expect = malloc(size);
+    actual = malloc(size);
+
+    for (i = 0; i < ARRAY_SIZE(orders); i++)
+    {
+        for (b = 0; b < ARRAY_SIZE(brightness); b++)
+        {
+            encode_lut_t fixed, shift;
+
+            channel.strip_type = orders[i].strip_type;
+            channel.brightness = brightness[b];
+            encode_lut_build(&fixed, channel.strip_type, channel.brightness, 0, 0);
+            shift = fixed;
+            shift.order = &encode_order_shift;
+
+            for (symbols = WS2811_SYMBOLS; symbols <= WS2811_SYMBOLS_ALIGNED; symbols++)
+            {
+                double shift_ns, fixed_ns;
+
+                memset(expect, 0, size);
+                memset(actual, 0, size);
+                shift_ns = time_orders(&channel, &shift, expect, symbols);
+                fixed_ns = time_orders(&channel, &fixed, actual, symbols);
+
+                if (memcmp(expect, actual, size))
+                {
+                    fprintf(stderr, "orders: %s output mismatch at brightness %d\n",
+                            orders[i].name, brightness[b]);
+                    ret = -1;
+                }
+
+                printf("%6s %6d %8d %12s %14.2f %14.2f %7.1fx\n", orders[i].name,
+                       brightness[b], symbols, fixed.order->name, shift_ns, fixed_ns,
+                       shift_ns / fixed_ns);
+            }
+        }
+    }
+
+    free(actual);
+    free(expect);
+    free(channel.leds);
+    encode_kernel_set(&encode_kernels[0]);
+
+    return ret;
+}
+
+/**
+ * Advance a test show by one frame: a comet moving along the strip over a dim
+ * background, plus a few LEDs twinkling at random.
+ *
+ * @param    leds    LEDs of the show.
+ * @param    count   Number of LEDs.
+ * @param    frame   Frame number.
+ *
+ * @returns  None
+ */
+static void show_frame(ws2811_led_t *leds, int count, int frame)
+{
+    int i;
+
+    for (i = 0; i < STREAM_COMET_LEDS; i++)
+    {
+        leds[(frame + i) % count] = 0x000004;
+    }
+    for (i = 0; i < STREAM_COMET_LEDS; i++)
+    {
+        leds[(frame + 1 + i) % count] = (i * 12) << 16 | (i * 6) << 8;
+    }
+
+    for (i = 0; i < (count / 50); i++)
+    {
+        leds[rand() % count] = rand() & 0xffffff;
+    }
+}
+
+static int bench_stream(void)
+{
+    unsigned i;
+    int ret = 0;
+
+    printf("%8s %12s %14s %12s %10s\n", "leds", "ns/frame", "Mleds/s", "MB/s read", "size");
+
+    for (i = 0; i < ARRAY_SIZE(led_counts); i++)
+    {
+        int count[RPI_PWM_CHANNELS] = { led_counts[i], 0 };
+        char path[] = "/tmp/bench-stream-XXXXXX";
+        ws2811_stream_writer_t writer;
+        ws2811_stream_t stream;
+        ws2811_led_t *show, *leds[RPI_PWM_CHANNELS];
+        ws2811_t ws2811;
+        uint64_t start, elapsed;
+        unsigned frames = 0;
+        int fd, frame;
+
+        fd = mkstemp(path);
+        if (fd == -1)
+        {
+            perror(path);
+            return -1;
+        }
+        close(fd);
+
+        show = calloc(count[0], sizeof(ws2811_led_t));
+        leds[0] = show;
+        leds[1] = NULL;
+        if (ws2811_stream_create(&writer, path, count, 60, 60))
+        {
+            perror(path);
+            return -1;
+        }
+        for (frame = 0; frame < STREAM_FRAMES; frame++)
+        {
+            show_frame(show, count[0], frame);
+            ws2811_stream_write(&writer, (const ws2811_led_t *const *)leds);
+        }
+        if (ws2811_stream_finish(&writer) || ws2811_stream_open(&stream, path))
+        {
+            fprintf(stderr, "stream: can't write %s\n", path);
+            return -1;
+        }
+        unlink(path);
+
+        memset(&ws2811, 0, sizeof(ws2811));
+        ws2811.channel[0].count = count[0];
+        ws2811.channel[0].leds = calloc(count[0], sizeof(ws2811_led_t));
+
+        start = now_ns();
+        do
+        {
+            ws2811_stream_seek(&stream, &ws2811, 0);
+            while (ws2811_stream_next(&stream, &ws2811) == 1)
+            {
+                frames++;
+            }
+            elapsed = now_ns() - start;
+        } while (elapsed < BENCH_MIN_NS);
+
+        if (memcmp(show, ws2811.channel[0].leds, count[0] * sizeof(ws2811_led_t)))
+        {
+            fprintf(stderr, "stream: output mismatch with %d leds\n", count[0]);
+            ret = -1;
+        }
+
+        printf("%8d %12.0f %14.1f %12.1f %9.1f%%\n", count[0], (double)elapsed / frames,
+               ((double)frames * count[0] * 1000.0) / elapsed,
+               ((double)stream.size * frames * 1000.0) / ((double)STREAM_FRAMES * elapsed),
+               (100.0 * stream.size) / ((double)STREAM_FRAMES * count[0] * sizeof(ws2811_led_t)));
+
+        ws2811_stream_close(&stream);
+        free(ws2811.channel[0].leds);
+        free(show);
+    }
+
+    return ret;
+}
+
+/**
+ * Framebuffer pixel of an LED of the layout bench, worked out from scratch the way
+ * an XY() helper would: 16x16 panels, 4x4 of them wired one after the other in rows,
+ * each serpentine and optionally turned by 90 degrees.
+ *
+ * @param    led      LED index on the channel.
+ * @param    rotated  Non-zero if the panels are turned.
+ *
+ * @returns  Pixel index.
+ */
+static int layout_pixel(int led, int rotated)
+{
+    int panel = led / (LAYOUT_PANEL * LAYOUT_PANEL);
+    int row = (led / LAYOUT_PANEL) % LAYOUT_PANEL;
+    int col = led % LAYOUT_PANEL;
+    int x, y;
+
+    if (row & 1)
+    {
+        col = LAYOUT_PANEL - 1 - col;
+    }
+
+    x = rotated ? LAYOUT_PANEL - 1 - row : col;
+    y = rotated ? col : row;
+    x += (panel % LAYOUT_TILES) * LAYOUT_PANEL;
+    y += (panel / LAYOUT_TILES) * LAYOUT_PANEL;
+
+    return (y * LAYOUT_TILES * LAYOUT_PANEL) + x;
+}
+
+/**
+ * Map a framebuffer onto serpentine panels per LED, through a precomputed index per
+ * LED, and with ws2811_layout_blit(), and check all three agree.
+ */
+static int bench_layout(void)
+{
+    static const char *const methods[] = { "per led", "index", "blit" };
+    const int size = LAYOUT_TILES * LAYOUT_PANEL;
+    const int count = size * size;
+    ws2811_panel_t panels[LAYOUT_TILES * LAYOUT_TILES];
+    ws2811_layout_t layout;
+    ws2811_led_t *fb, *expect;
+    int32_t *index;
+    ws2811_t ws2811;
+    int rotated, method, i, ret = 0;
+
+    printf("%8s %8s %6s %12s %14s\n", "panels", "method", "runs", "ns/LED", "Mpixels/s");
+
+    memset(&ws2811, 0, sizeof(ws2811));
+    ws2811.channel[0].count = count;
+    ws2811.channel[0].leds = malloc(count * sizeof(ws2811_led_t));
+    fb = malloc(count * sizeof(ws2811_led_t));
+    expect = malloc(count * sizeof(ws2811_led_t));
+    index = malloc(count * sizeof(int32_t));
+
+    for (i = 0; i < count; i++)
+    {
+        fb[i] = rand() & 0xffffff;
+    }
+
+    for (rotated = 0; rotated < 2; rotated++)
+    {
+        for (i = 0; i < LAYOUT_TILES * LAYOUT_TILES; i++)
+        {
+            panels[i] = (ws2811_panel_t)
+            {
+                .channel = 0,
+                .first = i * LAYOUT_PANEL * LAYOUT_PANEL,
+                .x = (i % LAYOUT_TILES) * LAYOUT_PANEL,
+                .y = (i / LAYOUT_TILES) * LAYOUT_PANEL,
+                .width = LAYOUT_PANEL,
+                .height = LAYOUT_PANEL,
+                .flags = WS2811_LAYOUT_SERPENTINE,
+                .rotation = rotated ? 90 : 0,
+            };
+        }
+
+        if (ws2811_layout_create(&layout, &ws2811, size, size, panels, ARRAY_SIZE(panels)))
+        {
+            fprintf(stderr, "layout: can't create the layout\n");
+            ret = -1;
+            break;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            index[i] = layout_pixel(i, rotated);
+            expect[i] = fb[index[i]];
+        }
+
+        for (method = 0; method < (int)ARRAY_SIZE(methods); method++)
+        {
+            ws2811_led_t *leds = ws2811.channel[0].leds;
+            uint64_t start, elapsed, iterations = 0;
+
+            memset(leds, 0, count * sizeof(ws2811_led_t));
+
+            start = now_ns();
+            do
+            {
+                switch (method)
+                {
+                    case 0:
+                        for (i = 0; i < count; i++)
+                        {
+                            leds[i] = fb[layout_pixel(i, rotated)];
+                        }
+                        break;
+
+                    case 1:
+                        for (i = 0; i < count; i++)
+                        {
+                            leds[i] = fb[index[i]];
+                        }
+                        break;
+
+                    default:
+                        ws2811_layout_blit(&layout, &ws2811, fb);
+                        break;
+                }
+                iterations++;
+                elapsed = now_ns() - start;
+            } while (elapsed < BENCH_MIN_NS);
+
+            if (memcmp(leds, expect, count * sizeof(ws2811_led_t)))
+            {
+                fprintf(stderr, "layout: %s output mismatch\n", methods[method]);
+                ret = -1;
+            }
+
+            printf("%8s %8s %6d %12.2f %14.1f\n", rotated ? "rotated" : "rows",
+                   methods[method], (method == 2) ? layout.runs : count,
+                   (double)elapsed / ((double)iterations * count),
+                   ((double)iterations * count * 1000.0) / elapsed);
+        }
+
+        ws2811_layout_free(&layout);
+    }
+
+    free(index);
+    free(expect);
+    free(fb);
+    free(ws2811.channel[0].leds);
+
+    return ret;
+}
+
+/**
+ * Blend the layers of the compose bench the way application code would, one color
+ * at a time with a division each, as the reference for the compositor.
+ *
+ * @param    ws2811  ws2811 instance to draw into.
+ * @param    comp    Compositor holding the layers.
+ *
+ * @returns  None
+ */
+static void compose_reference(ws2811_t *ws2811, const ws2811_compositor_t *comp)
+{
+    int chan, i, l, shift;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_led_t *leds = ws2811->channel[chan].leds;
+        int offset = chan ? comp->count[0] : 0;
+
+        for (i = 0; i < comp->count[chan]; i++)
+        {
+            ws2811_led_t led = 0;
+
+            for (l = 0; l < comp->layers; l++)
+            {
+                const ws2811_layer_t *layer = &comp->layer[l];
+                ws2811_argb_t pixel = layer->pixels[offset + i];
+                uint32_t alpha = ((pixel >> 24) * layer->opacity) / 255;
+                ws2811_led_t out = 0;
+
+                for (shift = 0; shift < 24; shift += 8)
+                {
+                    uint32_t d = (led >> shift) & 0xff;
+                    uint32_t s = (pixel >> shift) & 0xff;
+                    uint32_t c;
+
+                    switch (layer->blend)
+                    {
+                        case WS2811_COMPOSE_ADD:
+                            c = d + ((s * alpha) / 255);
+                            c = (c > 255) ? 255 : c;
+                            break;
+
+                        case WS2811_COMPOSE_MAX:
+                            c = (s * alpha) / 255;
+                            c = (d > c) ? d : c;
+                            break;
+
+                        case WS2811_COMPOSE_MULTIPLY:
+                            c = (d * (((s * alpha) / 255) + 255 - alpha)) / 255;
+                            break;
+
+                        default:
+                            c = ((s * alpha) + (d * (255 - alpha))) / 255;
+                            break;
+                    }
+
+                    out |= c << shift;
+                }
+
+                led = out;
+            }
+
+            leds[i] = led;
+        }
+    }
+}
+
+/**
+ * Composite a stack of layers, a background, an alpha blended overlay, sparkles
+ * added on top, a glow, a vignette and an empty notification layer, per color in
+ * plain C, with every layer changed and with only the top visible one changed.
+ */
+static int bench_compose(void)
+{
+    static const int blends[COMPOSE_LAYERS] =
+    {
+        WS2811_COMPOSE_ALPHA, WS2811_COMPOSE_ALPHA, WS2811_COMPOSE_ADD,
+        WS2811_COMPOSE_MAX, WS2811_COMPOSE_MULTIPLY, WS2811_COMPOSE_ALPHA,
+    };
+    static const char *const methods[] = { "per color", "all changed", "top changed" };
+    int c, ret = 0;
+
+    printf("%8s %12s %12s %14s\n", "leds", "method", "ns/LED", "us/frame");
+
+    for (c = 0; c < ARRAY_SIZE(led_counts); c++)
+    {
+        ws2811_compositor_t comp;
+        ws2811_led_t *expect[RPI_PWM_CHANNELS];
+        ws2811_t ws2811;
+        int count, chan, method, l, i;
+
+        fake_init(&ws2811, led_counts[c]);
+        if (ws2811_compositor_init(&comp, &ws2811, COMPOSE_LAYERS))
+        {
+            fprintf(stderr, "compose: out of memory\n");
+            fake_fini(&ws2811);
+            return -1;
+        }
+        count = comp.count[0] + comp.count[1];
+
+        for (l = 0; l < COMPOSE_LAYERS; l++)
+        {
+            ws2811_layer_t *layer = &comp.layer[l];
+
+            layer->blend = blends[l];
+            layer->opacity = (l == 1) ? 200 : 255;
+
+            for (i = 0; i < count; i++)
+            {
+                uint32_t color = rand() & 0xffffff;
+
+                switch (l)
+                {
+                    case 0:
+                        layer->pixels[i] = 0xff000000 | color;
+                        break;
+
+                    case 2:
+                        layer->pixels[i] = (i % 7) ? 0 : ((uint32_t)rand() << 24) | color;
+                        break;
+
+                    case COMPOSE_LAYERS - 1:
+                        layer->pixels[i] = color;
+                        break;
+
+                    default:
+                        layer->pixels[i] = ((uint32_t)rand() << 24) | color;
+                        break;
+                }
+            }
+        }
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            expect[chan] = malloc(ws2811.channel[chan].count * sizeof(ws2811_led_t));
+        }
+        compose_reference(&ws2811, &comp);
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            memcpy(expect[chan], ws2811.channel[chan].leds,
+                   ws2811.channel[chan].count * sizeof(ws2811_led_t));
+        }
+
+        for (method = 0; method < ARRAY_SIZE(methods); method++)
+        {
+            uint64_t start, elapsed, frames = 0;
+
+            for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+            {
+                memset(ws2811.channel[chan].leds, 0,
+                       ws2811.channel[chan].count * sizeof(ws2811_led_t));
+            }
+
+            start = now_ns();
+            do
+            {
+                switch (method)
+                {
+                    case 0:
+                        compose_reference(&ws2811, &comp);
+                        break;
+
+                    case 1:
+                        for (l = 0; l < COMPOSE_LAYERS; l++)
+                        {
+                            ws2811_layer_changed(&comp, l);
+                        }
+                        ws2811_composite(&comp, &ws2811);
+                        break;
+
+                    default:
+                        ws2811_layer_changed(&comp, COMPOSE_LAYERS - 2);
+                        ws2811_composite(&comp, &ws2811);
+                        break;
+                }
+                frames++;
+                elapsed = now_ns() - start;
+            } while (elapsed < BENCH_MIN_NS);
+
+            for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+            {
+                if (memcmp(ws2811.channel[chan].leds, expect[chan],
+                           ws2811.channel[chan].count * sizeof(ws2811_led_t)))
+                {
+                    fprintf(stderr, "compose: %s output mismatch with %d leds on channel %d\n",
+                            methods[method], led_counts[c], chan);
+                    ret = -1;
+                }
+            }
+
+            printf("%8d %12s %12.2f %14.1f\n", count, methods[method],
+                   (double)elapsed / ((double)frames * count),
+                   (double)elapsed / (frames * 1000.0));
+        }
+
+        if (ws2811_composite(&comp, &ws2811))
+        {
+            fprintf(stderr, "compose: composited again without any change\n");
+            ret = -1;
+        }
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            free(expect[chan]);
+        }
+        ws2811_compositor_fini(&comp);
+        fake_fini(&ws2811);
+    }
+
+    return ret;
+}
+
+/**
+ * Time trace events recorded with tracing off and on, and check they all made it into
+ * a saved trace.
+ */
+static int bench_trace(void)
+{
+    char path[] = "/tmp/bench-trace-XXXXXX";
+    ws2811_trace_header_t header;
+    uint64_t start, off_ns, on_ns;
+    FILE *file;
+    int fd, enable, i;
+
+    printf("%8s %12s\n", "tracing", "ns/event");
+
+    off_ns = on_ns = 0;
+    for (enable = 0; enable < 2; enable++)
+    {
+        ws2811_trace_enable(enable);
+
+        start = now_ns();
+        for (i = 0; i < TRACE_BENCH_EVENTS; i += 2)
+        {
+            ws2811_trace("bench", WS2811_TRACE_BEGIN);
+            ws2811_trace("bench", WS2811_TRACE_END);
+        }
+        *(enable ? &on_ns : &off_ns) = now_ns() - start;
+
+        printf("%8s %12.1f\n", enable ? "on" : "off",
+               (double)(enable ? on_ns : off_ns) / TRACE_BENCH_EVENTS);
+    }
+    ws2811_trace_enable(0);
+
+    fd = mkstemp(path);
+    if (fd == -1)
+    {
+        perror(path);
+        return -1;
+    }
+    close(fd);
+
+    file = NULL;
+    if (ws2811_trace_save(path) || !(file = fopen(path, "rb")) ||
+        (fread(&header, sizeof(header), 1, file) != 1) ||
+        (header.events != WS2811_TRACE_EVENTS) || (header.names != 1))
+    {
+        fprintf(stderr, "trace: saved trace doesn't hold the newest %d events\n",
+                WS2811_TRACE_EVENTS);
+        if (file)
+        {
+            fclose(file);
+        }
+        unlink(path);
+        return -1;
+    }
+    fclose(file);
+    unlink(path);
+
+    return 0;
+}
+
+static const struct
+{
+    const char *name;
+    const char *desc;
+    int (*run)(void);
+} benches[] =
+{
+    { "encode", "Bit at a time vs. table driven symbol encoding", bench_encode },
+    { "kernels", "Symbol expansion kernels, checked against the scalar kernel", bench_kernels },
+    { "interleave", "Per channel strided passes vs. a single interleaved pass", bench_interleave },
+    { "symbols", "3 symbols per bit vs. the word aligned 4 symbol mode", bench_symbols },
+    { "orders", "Gathers with run time shifts vs. specialized per strip type", bench_orders },
+    { "stream", "Frame stream decoding, size relative to raw frames", bench_stream },
+    { "trace", "Cost of a trace event with tracing off and on", bench_trace },
+    { "layout", "Framebuffer to panels per LED, by index and as runs", bench_layout },
+    { "compose", "Layers blended per color vs. the fixed point compositor", bench_compose },
+};
+
+
+int main(int argc, char *argv[])
+{
+    unsigned i;
+    int ret = 0;
+
+    for (i = 0; i < ARRAY_SIZE(benches); i++)
+    {
+        int arg, selected = (argc < 2);
+
+        for (arg = 1; arg < argc; arg++)
+        {
+            if (!strcmp(argv[arg], benches[i].name))
+            {
+                selected = 1;
+            }
+        }
+
+        if (!selected)
+        {
+            continue;
+        }
+
+        printf("== %s: %s\n", benches[i].name, benches[i].desc);
+        if (benches[i].run())
+        {
+            ret = -1;
+        }
+        printf("\n");
+    }
+
+    return ret;
+}
@@ -0,0 +1,335 @@
+/*
+ * client.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ws2811.h"
+#include "client.h"
+
+
+#define CLIENT_ALIGN(size)                       (((size) + WS2811_CLIENT_ALIGN - 1) & \
+                                                  ~(WS2811_CLIENT_ALIGN - 1))
+
+
+/**
+ * Bytes from one slot to the next.
+ *
+ * @param    leds    LEDs in a frame, all channels.
+ *
+ * @returns  Slot size.
+ */
+static size_t slot_size(uint32_t leds)
+{
+    return CLIENT_ALIGN(sizeof(ws2811_client_slot_t) +
+                        (WS2811_CLIENT_BUFFERS * leds * sizeof(ws2811_led_t)));
+}
+
+/**
+ * Size of the shared memory object for a number of slots, as created by the daemon.
+ *
+ * @param    slots   Number of client slots.
+ * @param    count   LEDs per channel.
+ *
+ * @returns  Size in bytes.
+ */
+size_t ws2811_client_size(int slots, const int *count)
+{
+    return CLIENT_ALIGN(sizeof(ws2811_client_header_t)) +
+           (slots * slot_size(count[0] + count[1]));
+}
+
+/**
+ * Find a slot in the shared memory object.
+ *
+ * @param    header  Start of the shared memory object.
+ * @param    index   Slot number.
+ *
+ * @returns  Pointer to the slot.
+ */
+static ws2811_client_slot_t *client_slot(ws2811_client_header_t *header, int index)
+{
+    return (ws2811_client_slot_t *)((uint8_t *)header + header->slot_offset +
+                                    (index * header->slot_size));
+}
+
+/**
+ * Free a slot.  A frame published but not taken yet is dropped, so the next client
+ * doesn't start out showing it.
+ *
+ * @param    slot    Slot to free.
+ *
+ * @returns  None
+ */
+static void client_release(ws2811_client_slot_t *slot)
+{
+    uint32_t middle;
+
+    middle = __atomic_exchange_n(&slot->middle, slot->back, __ATOMIC_ACQ_REL);
+    slot->back = middle & ~WS2811_CLIENT_FRESH;
+
+    __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Get one of the client's frame buffers.
+ *
+ * @param    client  Client.
+ * @param    buffer  Buffer number.
+ *
+ * @returns  Pointer to the first LED of the buffer.
+ */
+static ws2811_led_t *client_buffer(ws2811_client_t *client, uint32_t buffer)
+{
+    return &client->slot->buffers[buffer * client->leds];
+}
+
+/**
+ * Connect to the daemon and claim a free slot.  The slot's back buffer starts out
+ * black.
+ *
+ * @param    client    Client state to fill in.
+ * @param    name      Shared memory object, NULL for WS2811_CLIENT_NAME.
+ * @param    priority  Slots with a higher priority are composited on top.
+ * @param    blend     How to composite on top of lower slots, WS2811_BLEND_xxx.
+ *
+ * @returns  0 on success, -1 with errno set on error, EBUSY if all slots are taken.
+ */
+int ws2811_client_open(ws2811_client_t *client, const char *name, int priority, int blend)
+{
+    ws2811_client_header_t *header;
+    struct stat st;
+    uint32_t pid = getpid();
+    void *map;
+    int fd, i;
+
+    fd = shm_open(name ? name : WS2811_CLIENT_NAME, O_RDWR, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) || (st.st_size < sizeof(*header)))
+    {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    header = map;
+    if ((header->magic != WS2811_CLIENT_MAGIC) ||
+        (header->version != WS2811_CLIENT_VERSION) ||
+        (header->channels != RPI_PWM_CHANNELS) ||
+        (header->slot_size != slot_size(header->count[0] + header->count[1])) ||
+        (st.st_size < (header->slot_offset + ((size_t)header->slots * header->slot_size))))
+    {
+        munmap(map, st.st_size);
+        errno = EINVAL;
+        return -1;
+    }
+
+    client->map = map;
+    client->size = st.st_size;
+    client->header = header;
+    client->leds = header->count[0] + header->count[1];
+
+    for (i = 0; i < header->slots; i++)
+    {
+        ws2811_client_slot_t *slot = client_slot(header, i);
+        uint32_t free = 0;
+
+        if (__atomic_compare_exchange_n(&slot->owner, &free, pid, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+        {
+            client->slot = slot;
+            slot->priority = priority;
+            slot->blend = blend;
+            slot->published = 0;
+            memset(client_buffer(client, slot->back), 0, client->leds * sizeof(ws2811_led_t));
+
+            return 0;
+        }
+    }
+
+    munmap(map, st.st_size);
+    errno = EBUSY;
+
+    return -1;
+}
+
+/**
+ * Give the slot back and disconnect.  The daemon stops showing it at its next frame.
+ *
+ * @param    client  Client from ws2811_client_open().
+ *
+ * @returns  None
+ */
+void ws2811_client_close(ws2811_client_t *client)
+{
+    client_release(client->slot);
+
+    munmap(client->map, client->size);
+    client->map = NULL;
+    client->header = NULL;
+    client->slot = NULL;
+}
+
+/**
+ * Number of LEDs the daemon drives on a channel.
+ *
+ * @param    client  Client.
+ * @param    channel Channel number.
+ *
+ * @returns  LED count.
+ */
+int ws2811_client_count(ws2811_client_t *client, int channel)
+{
+    return client->header->count[channel];
+}
+
+/**
+ * Get the LEDs of a channel to draw into.  They live in the back buffer, which
+ * changes with every publish, so get them again after each one.
+ *
+ * @param    client  Client.
+ * @param    channel Channel number.
+ *
+ * @returns  Pointer to ws2811_client_count() LEDs.
+ */
+ws2811_led_t *ws2811_client_leds(ws2811_client_t *client, int channel)
+{
+    return client_buffer(client, client->slot->back) + (channel ? client->header->count[0] : 0);
+}
+
+/**
+ * Hand the back buffer to the daemon, to show from its next frame on.  The new back
+ * buffer starts out as a copy of the published one, so drawing can carry on where
+ * it left off.  Never blocks and makes no system call.
+ *
+ * @param    client  Client.
+ *
+ * @returns  None
+ */
+void ws2811_client_publish(ws2811_client_t *client)
+{
+    ws2811_client_slot_t *slot = client->slot;
+    uint32_t published = slot->back;
+    uint32_t middle;
+
+    middle = __atomic_exchange_n(&slot->middle, published | WS2811_CLIENT_FRESH,
+                                 __ATOMIC_ACQ_REL);
+    slot->back = middle & ~WS2811_CLIENT_FRESH;
+
+    // The daemon only ever reads the published buffer, and can't hand it back
+    // before the next publish
+    memcpy(client_buffer(client, slot->back), client_buffer(client, published),
+           client->leds * sizeof(ws2811_led_t));
+
+    slot->published++;
+}
+
+/**
+ * Wait for the daemon to render its next frame, to draw in step with it.
+ *
+ * @param    client      Client.
+ * @param    timeout_ms  Longest to wait, -1 for no limit.
+ *
+ * @returns  0 once a frame was rendered, -1 with errno set on timeout or if the daemon
+ *           went away.
+ */
+int ws2811_client_wait(ws2811_client_t *client, int timeout_ms)
+{
+    ws2811_client_header_t *header = client->header;
+    uint32_t frame = __atomic_load_n(&header->frame, __ATOMIC_ACQUIRE);
+    struct timespec now, timeout;
+    uint64_t deadline = 0;
+
+    // Wakeups and signals restart the wait, so it runs to a deadline
+    if (timeout_ms >= 0)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        deadline = ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec +
+                   (timeout_ms * 1000000ULL);
+    }
+
+    while (__atomic_load_n(&header->frame, __ATOMIC_ACQUIRE) == frame)
+    {
+        if (!header->daemon_pid)
+        {
+            errno = EPIPE;
+            return -1;
+        }
+
+        if (timeout_ms >= 0)
+        {
+            uint64_t ns;
+
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            ns = ((uint64_t)now.tv_sec * 1000000000ULL) + now.tv_nsec;
+            if (ns >= deadline)
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+
+            timeout.tv_sec = (deadline - ns) / 1000000000ULL;
+            timeout.tv_nsec = (deadline - ns) % 1000000000ULL;
+        }
+
+        if (syscall(SYS_futex, &header->frame, FUTEX_WAIT, frame,
+                    (timeout_ms < 0) ? NULL : &timeout, NULL, 0) &&
+            (errno == ETIMEDOUT))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
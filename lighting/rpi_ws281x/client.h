@@ -0,0 +1,112 @@
+/*
+ * client.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __CLIENT_H__
+#define __CLIENT_H__
+
+#include <stdint.h>
+
+#include "ws2811.h"
+
+/*
+ * Shared memory frame slots of the ledd daemon.
+ *
+ * ledd owns the hardware and publishes one POSIX shared memory object.  It starts
+ * with a header, followed by a number of client slots, each holding three frame
+ * buffers of all LEDs, channel 0 first.  A client claims a free slot by writing its
+ * pid into the owner field, draws into its back buffer and publishes it by swapping
+ * it with the middle buffer, marking that fresh.  At every frame the daemon swaps
+ * a fresh middle buffer with its front buffer, which only it keeps track of,
+ * composites the front buffers of all slots by priority and renders the result.
+ * Neither side ever waits for the other, and publishing a frame is a memory copy
+ * and an atomic exchange, without any system call.  The frame counter in the header
+ * doubles as a futex, for clients that want to draw in step with the daemon.
+ */
+
+#define WS2811_CLIENT_NAME                       "/ledd"      // Default shared memory object
+#define WS2811_CLIENT_MAGIC                      0x44444c57   // "WLDD"
+#define WS2811_CLIENT_VERSION                    1
+
+#define WS2811_CLIENT_BUFFERS                    3            // Triple buffered
+#define WS2811_CLIENT_FRESH                      0x80000000   // Middle buffer not taken yet
+#define WS2811_CLIENT_ALIGN                      64           // Slots start on a cache line
+
+#define WS2811_BLEND_OPAQUE                      0            // Replace lower slots entirely
+#define WS2811_BLEND_OVER                        1            // Replace where not black
+#define WS2811_BLEND_ADD                         2            // Add, saturating
+
+typedef struct
+{
+    uint32_t magic;                              //< WS2811_CLIENT_MAGIC
+    uint16_t version;                            //< WS2811_CLIENT_VERSION
+    uint16_t channels;                           //< RPI_PWM_CHANNELS
+    uint32_t count[RPI_PWM_CHANNELS];            //< LEDs per channel
+    uint32_t slots;                              //< Number of client slots
+    uint32_t slot_offset;                        //< Offset of the first slot
+    uint32_t slot_size;                          //< Bytes from one slot to the next
+    uint32_t fps;                                //< Rate the daemon renders at
+    volatile uint32_t daemon_pid;                //< 0 once the daemon went away
+    volatile uint32_t frame;                     //< Frames rendered, futex word
+} ws2811_client_header_t;
+
+typedef struct
+{
+    volatile uint32_t owner;                     //< Client pid, 0 if the slot is free
+    volatile int32_t priority;                   //< Higher slots are composited on top
+    volatile uint32_t blend;                     //< WS2811_BLEND_xxx
+    volatile uint32_t middle;                    //< Middle buffer, WS2811_CLIENT_FRESH if new
+    uint32_t back;                               //< Buffer the client draws into
+    volatile uint32_t published;                 //< Frames the client published
+    uint32_t reserved[10];
+    ws2811_led_t buffers[];                      //< WS2811_CLIENT_BUFFERS frames of all LEDs
+} ws2811_client_slot_t;
+
+// A client's view of its slot
+typedef struct
+{
+    void *map;
+    size_t size;
+    ws2811_client_header_t *header;
+    ws2811_client_slot_t *slot;
+    uint32_t leds;                               //< LEDs in a frame, all channels
+} ws2811_client_t;
+
+
+int ws2811_client_open(ws2811_client_t *client, const char *name, int priority, int blend);
+void ws2811_client_close(ws2811_client_t *client);
+int ws2811_client_count(ws2811_client_t *client, int channel);
+ws2811_led_t *ws2811_client_leds(ws2811_client_t *client, int channel);
+void ws2811_client_publish(ws2811_client_t *client);
+int ws2811_client_wait(ws2811_client_t *client, int timeout_ms);
+
+size_t ws2811_client_size(int slots, const int *count);
+
+
+#endif /* __CLIENT_H__ */
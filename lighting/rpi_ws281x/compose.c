@@ -0,0 +1,446 @@
+/*
+ * compose.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2811.h"
+#include "compose.h"
+
+
+#define RB_MASK                                  0x00ff00ff   // Red and blue, two 16-bit lanes
+
+
+/**
+ * Divide by 255, exact for products of two 8-bit values.
+ */
+static inline uint32_t div255(uint32_t x)
+{
+    return (x + 1 + (x >> 8)) >> 8;
+}
+
+/**
+ * div255() of both 16-bit lanes of a word at once.  Neither lane may exceed 255 * 255,
+ * so nothing carries from one into the other.
+ */
+static inline uint32_t div255x2(uint32_t x)
+{
+    return ((x + 0x00010001 + ((x >> 8) & RB_MASK)) >> 8) & RB_MASK;
+}
+
+/**
+ * Scale the colors of a pixel by an alpha value, red and blue in one multiply.
+ *
+ * @param    color  0x..RRGGBB.
+ * @param    alpha  0 to 255.
+ *
+ * @returns  0x00RRGGBB.
+ */
+static inline uint32_t color_scale(uint32_t color, uint32_t alpha)
+{
+    return div255x2((color & RB_MASK) * alpha) | (div255x2(((color >> 8) & 0xff) * alpha) << 8);
+}
+
+/**
+ * Per lane maximum of two words holding two 8-bit values each, in 0x00XX00YY form.
+ */
+static inline uint32_t lanes_max(uint32_t x, uint32_t y)
+{
+    // Bit 8 of each lane of 0x100 + x - y is set where x >= y, and no lane borrows
+    uint32_t mask = ((((x | 0x01000100) - y) >> 8) & 0x00010001) * 0xff;
+
+    return (x & mask) | (y & ~mask);
+}
+
+/**
+ * Per byte saturating add, each color saturating at 255 instead of wrapping around.
+ */
+static inline uint32_t color_add(uint32_t a, uint32_t b)
+{
+    uint32_t sum, carry;
+
+    // Add the low 7 bits of each byte, then the top bits without carrying out
+    sum = ((a & 0x7f7f7f7f) + (b & 0x7f7f7f7f)) ^ ((a ^ b) & 0x80808080);
+    carry = ((a & b) | ((a | b) & ~sum)) & 0x80808080;
+
+    return sum | ((carry >> 7) * 0xff);
+}
+
+/**
+ * Blend a range of a layer into LEDs.  Every mode is a loop without branches over
+ * the pixels, so the compiler is free to vectorize it.
+ *
+ * @param    leds     LEDs composited so far.
+ * @param    src      Layer pixels.
+ * @param    count    Number of LEDs.
+ * @param    blend    WS2811_COMPOSE_xxx.
+ * @param    opacity  Layer opacity, 0 to 255.
+ *
+ * @returns  None
+ */
+static void layer_blend(ws2811_led_t *leds, const ws2811_argb_t *src, int count, int blend,
+                        uint32_t opacity)
+{
+    int i;
+
+    switch (blend)
+    {
+        case WS2811_COMPOSE_ADD:
+            for (i = 0; i < count; i++)
+            {
+                uint32_t alpha = div255((src[i] >> 24) * opacity);
+
+                leds[i] = color_add(leds[i], color_scale(src[i], alpha));
+            }
+            break;
+
+        case WS2811_COMPOSE_MAX:
+            for (i = 0; i < count; i++)
+            {
+                uint32_t alpha = div255((src[i] >> 24) * opacity);
+                uint32_t color = color_scale(src[i], alpha);
+
+                leds[i] = lanes_max(leds[i] & RB_MASK, color & RB_MASK) |
+                          (lanes_max((leds[i] >> 8) & 0xff, (color >> 8) & 0xff) << 8);
+            }
+            break;
+
+        case WS2811_COMPOSE_MULTIPLY:
+            for (i = 0; i < count; i++)
+            {
+                uint32_t alpha = div255((src[i] >> 24) * opacity);
+                uint32_t led = leds[i];
+                uint32_t k;
+
+                // Factor per color, from 255 without alpha down to the color at full alpha
+                k = color_scale(src[i], alpha) + ((255 - alpha) * 0x010101);
+
+                leds[i] = (div255(((led >> 16) & 0xff) * ((k >> 16) & 0xff)) << 16) |
+                          (div255(((led >> 8) & 0xff) * ((k >> 8) & 0xff)) << 8) |
+                          div255((led & 0xff) * (k & 0xff));
+            }
+            break;
+
+        default:
+            for (i = 0; i < count; i++)
+            {
+                uint32_t alpha = div255((src[i] >> 24) * opacity);
+                uint32_t led = leds[i];
+
+                leds[i] = div255x2(((src[i] & RB_MASK) * alpha) +
+                                   ((led & RB_MASK) * (255 - alpha))) |
+                          (div255x2((((src[i] >> 8) & 0xff) * alpha) +
+                                    (((led >> 8) & 0xff) * (255 - alpha))) << 8);
+            }
+            break;
+    }
+}
+
+static uint32_t layer_opacity(const ws2811_layer_t *layer)
+{
+    return (layer->opacity < 0) ? 0 : ((layer->opacity > 255) ? 255 : layer->opacity);
+}
+
+/**
+ * Look at the alpha of all pixels of a layer that changed.
+ *
+ * @param    layer    Layer.
+ * @param    count    Number of pixels.
+ *
+ * @returns  None
+ */
+static void layer_scan(ws2811_layer_t *layer, int count)
+{
+    uint32_t opacity = layer_opacity(layer);
+    uint32_t any = 0, all = 0xffffffff;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        any |= layer->pixels[i];
+        all &= layer->pixels[i];
+    }
+
+    layer->transparent = !(any >> 24) || !opacity;
+    layer->opaque = ((all >> 24) == 0xff) && (opacity == 255) &&
+                    (layer->blend == WS2811_COMPOSE_ALPHA);
+}
+
+/**
+ * Set up a compositor for the LEDs of an instance, with all layers transparent and
+ * alpha blended.  Call it again after changing the LED counts.
+ *
+ * @param    comp    Compositor to fill in.
+ * @param    ws2811  Initialized ws2811 instance.
+ * @param    layers  Number of layers.
+ *
+ * @returns  0 on success, -1 if out of memory.
+ */
+int ws2811_compositor_init(ws2811_compositor_t *comp, ws2811_t *ws2811, int layers)
+{
+    int count = 0;
+    int chan, i;
+
+    memset(comp, 0, sizeof(*comp));
+    comp->cached = -1;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        comp->count[chan] = ws2811->channel[chan].count;
+        count += comp->count[chan];
+    }
+
+    comp->layer = calloc(layers ? layers : 1, sizeof(*comp->layer));
+    comp->cache = malloc((count ? count : 1) * sizeof(*comp->cache));
+    if (!comp->layer || !comp->cache)
+    {
+        goto err;
+    }
+    comp->layers = layers;
+
+    for (i = 0; i < layers; i++)
+    {
+        ws2811_layer_t *layer = &comp->layer[i];
+
+        layer->pixels = calloc(count ? count : 1, sizeof(*layer->pixels));
+        if (!layer->pixels)
+        {
+            goto err;
+        }
+        layer->blend = layer->blend_used = WS2811_COMPOSE_ALPHA;
+        layer->opacity = layer->opacity_used = 255;
+        layer->transparent = 1;
+    }
+
+    return 0;
+
+err:
+    ws2811_compositor_fini(comp);
+
+    return -1;
+}
+
+/**
+ * Free a compositor's layers.
+ *
+ * @param    comp  Compositor from ws2811_compositor_init().
+ *
+ * @returns  None
+ */
+void ws2811_compositor_fini(ws2811_compositor_t *comp)
+{
+    int i;
+
+    if (comp->layer)
+    {
+        for (i = 0; i < comp->layers; i++)
+        {
+            free(comp->layer[i].pixels);
+        }
+    }
+
+    free(comp->layer);
+    free(comp->cache);
+    memset(comp, 0, sizeof(*comp));
+    comp->cached = -1;
+}
+
+/**
+ * Mark a layer's pixels as changed, to be blended again by the next composite.
+ * Changes to its blend mode or opacity are noticed without this.
+ *
+ * @param    comp   Compositor.
+ * @param    layer  Layer number.
+ *
+ * @returns  None
+ */
+void ws2811_layer_changed(ws2811_compositor_t *comp, int layer)
+{
+    if ((layer >= 0) && (layer < comp->layers))
+    {
+        comp->layer[layer].changed = 1;
+    }
+}
+
+/**
+ * Blend all layers into the channels' LEDs, bottom first.  Starts from the kept
+ * composite of the layers below the lowest changed one, or from the topmost opaque
+ * alpha layer, whichever is higher.
+ *
+ * @param    comp    Compositor.
+ * @param    ws2811  ws2811 instance the compositor was set up for.
+ *
+ * @returns  1 if the LEDs were updated, 0 if no layer changed since the last
+ *           composite, -1 if the LED counts changed.
+ */
+int ws2811_composite(ws2811_compositor_t *comp, ws2811_t *ws2811)
+{
+    int low = comp->layers, first = -1;
+    int start, chan, i;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].count != comp->count[chan])
+        {
+            return -1;
+        }
+    }
+
+    for (i = 0; i < comp->layers; i++)
+    {
+        ws2811_layer_t *layer = &comp->layer[i];
+
+        if ((layer->blend != layer->blend_used) || (layer->opacity != layer->opacity_used))
+        {
+            layer->changed = 1;
+        }
+
+        if (layer->changed)
+        {
+            layer_scan(layer, comp->count[0] + comp->count[1]);
+
+            if (i < low)
+            {
+                low = i;
+            }
+        }
+
+        if (layer->opaque)
+        {
+            first = i;
+        }
+    }
+
+    if ((low == comp->layers) && comp->shown)
+    {
+        return 0;
+    }
+
+    // The cache only holds layers that didn't change
+    if (comp->cached > low)
+    {
+        comp->cached = -1;
+    }
+
+    start = (comp->cached > first) ? comp->cached : ((first >= 0) ? first : 0);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        int offset = chan ? comp->count[0] : 0;
+        ws2811_led_t *leds = ws2811->channel[chan].leds;
+        int count = comp->count[chan];
+
+        if (start == comp->cached)
+        {
+            memcpy(leds, &comp->cache[offset], count * sizeof(*leds));
+        }
+        else if (start != first)
+        {
+            memset(leds, 0, count * sizeof(*leds));
+        }
+    }
+
+    for (i = start; i < comp->layers; i++)
+    {
+        ws2811_layer_t *layer = &comp->layer[i];
+        uint32_t opacity = layer_opacity(layer);
+
+        // Keep what's below the lowest changed layer for the next composite
+        if ((i == low) && (i > start))
+        {
+            for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+            {
+                int offset = chan ? comp->count[0] : 0;
+
+                memcpy(&comp->cache[offset], ws2811->channel[chan].leds,
+                       comp->count[chan] * sizeof(*comp->cache));
+            }
+            comp->cached = i;
+        }
+
+        if (layer->transparent)
+        {
+            continue;
+        }
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            int offset = chan ? comp->count[0] : 0;
+            ws2811_led_t *leds = ws2811->channel[chan].leds;
+            const ws2811_argb_t *src = &layer->pixels[offset];
+            int count = comp->count[chan];
+            int j;
+
+            if (i == first)
+            {
+                for (j = 0; j < count; j++)
+                {
+                    leds[j] = src[j] & 0xffffff;
+                }
+            }
+            else
+            {
+                layer_blend(leds, src, count, layer->blend, opacity);
+            }
+        }
+    }
+
+    for (i = 0; i < comp->layers; i++)
+    {
+        comp->layer[i].changed = 0;
+        comp->layer[i].blend_used = comp->layer[i].blend;
+        comp->layer[i].opacity_used = comp->layer[i].opacity;
+    }
+    comp->shown = 1;
+
+    return 1;
+}
+
+/**
+ * Add LEDs onto others, each color saturating at 255 instead of wrapping around.
+ * White is added too, so this works for plain LEDs outside of any compositor.
+ *
+ * @param    leds    LEDs to add onto.
+ * @param    src     LEDs to add.
+ * @param    count   Number of LEDs.
+ *
+ * @returns  None
+ */
+void ws2811_leds_add(ws2811_led_t *leds, const ws2811_led_t *src, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        leds[i] = color_add(leds[i], src[i]);
+    }
+}
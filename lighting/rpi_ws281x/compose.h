@@ -0,0 +1,88 @@
+/*
+ * compose.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __COMPOSE_H__
+#define __COMPOSE_H__
+
+#include <stdint.h>
+
+#include "ws2811.h"
+
+/*
+ * Compositor for scenes built from stacked layers.
+ *
+ * Each layer holds one 0xAARRGGBB pixel per LED, channel 0 first, and a blend mode
+ * that says how it combines with the layers below.  ws2811_composite() blends them
+ * bottom to top straight into the channels' LEDs, in 8-bit fixed point, with two
+ * colors per multiply.  Layers without any alpha are skipped, and so is everything
+ * below the topmost fully opaque alpha layer.  The composite of the layers below
+ * the lowest one that changes is kept, so an animated overlay on a static
+ * background only costs blending the overlay each frame, and nothing at all is
+ * done while no layer changes.
+ */
+
+#define WS2811_COMPOSE_ALPHA                     0            // Over the layers below, by alpha
+#define WS2811_COMPOSE_ADD                       1            // Add, scaled by alpha, saturating
+#define WS2811_COMPOSE_MAX                       2            // Brighter of the two per color
+#define WS2811_COMPOSE_MULTIPLY                  3            // Darken the layers below
+
+typedef uint32_t ws2811_argb_t;                  //< 0xAARRGGBB, alpha 255 is opaque
+
+typedef struct
+{
+    ws2811_argb_t *pixels;                       //< One per LED, allocated by the compositor
+    int blend;                                   //< WS2811_COMPOSE_xxx
+    int opacity;                                 //< Scales every pixel's alpha, 255 for none
+    int changed;                                 //< Set by ws2811_layer_changed()
+    int transparent;                             //< No pixel has any alpha, as of the last scan
+    int opaque;                                  //< Every pixel has full alpha
+    int blend_used;                              //< Settings of the last composite
+    int opacity_used;
+} ws2811_layer_t;
+
+typedef struct
+{
+    int layers;
+    ws2811_layer_t *layer;                       //< Bottom layer first
+    int count[RPI_PWM_CHANNELS];                 //< LEDs per channel
+    ws2811_led_t *cache;                         //< Composite of the bottom cached layers
+    int cached;                                  //< Layers in the cache, -1 if it's stale
+    int shown;                                   //< LEDs hold the composite of all layers
+} ws2811_compositor_t;
+
+
+int ws2811_compositor_init(ws2811_compositor_t *comp, ws2811_t *ws2811, int layers);
+void ws2811_compositor_fini(ws2811_compositor_t *comp);
+void ws2811_layer_changed(ws2811_compositor_t *comp, int layer);
+int ws2811_composite(ws2811_compositor_t *comp, ws2811_t *ws2811);
+void ws2811_leds_add(ws2811_led_t *leds, const ws2811_led_t *src, int count);
+
+
+#endif /* __COMPOSE_H__ */
@@ -0,0 +1,834 @@
+/*
+ * encode.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "ws2811.h"
+
+#include "encode.h"
+
+
+/*
+ * Symbol pattern for a single color bit, placed at its position within the
+ * 24-bit expansion of the color byte.  The MSB of the color goes out first.
+ */
+#define ENCODE_BIT(byte, bit)                    ((((byte) & (1 << (bit))) ? SYMBOL_HIGH : SYMBOL_LOW) \
+                                                  << ((bit) * 3))
+
+#define ENCODE_BYTE(byte)                        (ENCODE_BIT(byte, 7) | ENCODE_BIT(byte, 6) | \
+                                                  ENCODE_BIT(byte, 5) | ENCODE_BIT(byte, 4) | \
+                                                  ENCODE_BIT(byte, 3) | ENCODE_BIT(byte, 2) | \
+                                                  ENCODE_BIT(byte, 1) | ENCODE_BIT(byte, 0))
+
+// The same with 4 symbols per bit, filling the whole word
+#define ENCODE4_BIT(byte, bit)                   ((((byte) & (1 << (bit))) ? SYMBOL4_HIGH : SYMBOL4_LOW) \
+                                                  << ((bit) * 4))
+
+#define ENCODE4_BYTE(byte)                       (ENCODE4_BIT(byte, 7) | ENCODE4_BIT(byte, 6) | \
+                                                  ENCODE4_BIT(byte, 5) | ENCODE4_BIT(byte, 4) | \
+                                                  ENCODE4_BIT(byte, 3) | ENCODE4_BIT(byte, 2) | \
+                                                  ENCODE4_BIT(byte, 1) | ENCODE4_BIT(byte, 0))
+
+#define ENCODE_4(enc, byte)                      enc(byte),               enc((byte) + 1), \
+                                                 enc((byte) + 2),         enc((byte) + 3)
+#define ENCODE_16(enc, byte)                     ENCODE_4(enc, byte),         ENCODE_4(enc, (byte) + 4), \
+                                                 ENCODE_4(enc, (byte) + 8),   ENCODE_4(enc, (byte) + 12)
+#define ENCODE_64(enc, byte)                     ENCODE_16(enc, byte),        ENCODE_16(enc, (byte) + 16), \
+                                                 ENCODE_16(enc, (byte) + 32), ENCODE_16(enc, (byte) + 48)
+
+
+// Color byte to PWM symbol bits, right justified in each word
+const uint32_t encode_table[256] =
+{
+    ENCODE_64(ENCODE_BYTE, 0),
+    ENCODE_64(ENCODE_BYTE, 64),
+    ENCODE_64(ENCODE_BYTE, 128),
+    ENCODE_64(ENCODE_BYTE, 192),
+};
+
+// Color byte to a whole word of PWM symbol bits, in word aligned mode
+const uint32_t encode_table4[256] =
+{
+    ENCODE_64(ENCODE4_BYTE, 0),
+    ENCODE_64(ENCODE4_BYTE, 64),
+    ENCODE_64(ENCODE4_BYTE, 128),
+    ENCODE_64(ENCODE4_BYTE, 192),
+};
+
+
+/*
+ * The SIMD kernels build the 3 bytes of each 24-bit expansion separately.  Every
+ * byte depends on only a few of the color bits, the rest of its bits are fixed
+ * symbol bits, so each one is a lookup into a table of at most 8 entries:
+ *
+ *     expansion bits 23..16  <-  color bits 7..5
+ *     expansion bits 15..8   <-  color bits 4..3
+ *     expansion bits  7..0   <-  color bits 2..0
+ */
+#define LUT_HI(idx)                              ((ENCODE_BYTE((idx) << 5) >> 16) & 0xff)
+#define LUT_MID(idx)                             ((ENCODE_BYTE((idx) << 3) >> 8) & 0xff)
+#define LUT_LO(idx)                              ((ENCODE_BYTE(idx) >> 0) & 0xff)
+
+#define LUT_8(lut)                               lut(0), lut(1), lut(2), lut(3), \
+                                                 lut(4), lut(5), lut(6), lut(7)
+
+
+/*
+ * Scalar kernel.  Four color bytes expand to 96 bits, exactly three words.
+ */
+static void expand_scalar(uint32_t *words, const uint8_t *bytes, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i += 4)
+    {
+        uint32_t s0 = encode_table[bytes[i + 0]];
+        uint32_t s1 = encode_table[bytes[i + 1]];
+        uint32_t s2 = encode_table[bytes[i + 2]];
+        uint32_t s3 = encode_table[bytes[i + 3]];
+
+        words[0] = (s0 << 8)  | (s1 >> 16);
+        words[1] = (s1 << 16) | (s2 >> 8);
+        words[2] = (s2 << 24) | s3;
+        words += 3;
+    }
+}
+
+static int supported_always(void)
+{
+    return 1;
+}
+
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+ * The expansion bytes come out of the lookups in stream order, high byte of the
+ * first color first, and the words are stored little endian.  Byte 'pos' of the
+ * output, counted from the start of the 48 bytes a 16 byte block expands to, is
+ * stream byte STREAM_POS(pos), which is byte (STREAM_POS(pos) % 3) of the
+ * expansion of color byte (STREAM_POS(pos) / 3).
+ */
+#define STREAM_POS(pos)                          (((pos) & ~0x3) + 3 - ((pos) & 0x3))
+#define STREAM_SEL(pos, part)                    ((STREAM_POS(pos) % 3) == (part) ? \
+                                                  STREAM_POS(pos) / 3 : 0x80)
+#define STREAM_SEL_4(pos, part)                  STREAM_SEL((pos) + 0, part), STREAM_SEL((pos) + 1, part), \
+                                                 STREAM_SEL((pos) + 2, part), STREAM_SEL((pos) + 3, part)
+#define STREAM_SEL_16(vec, part)                 STREAM_SEL_4(((vec) * 16) + 0, part), \
+                                                 STREAM_SEL_4(((vec) * 16) + 4, part), \
+                                                 STREAM_SEL_4(((vec) * 16) + 8, part), \
+                                                 STREAM_SEL_4(((vec) * 16) + 12, part)
+
+// Shuffle masks for output vector 'vec' from the hi (0), mid (1) and lo (2) bytes
+static const uint8_t stream_sel[3][3][16] __attribute__((aligned(16))) =
+{
+    { { STREAM_SEL_16(0, 0) }, { STREAM_SEL_16(0, 1) }, { STREAM_SEL_16(0, 2) } },
+    { { STREAM_SEL_16(1, 0) }, { STREAM_SEL_16(1, 1) }, { STREAM_SEL_16(1, 2) } },
+    { { STREAM_SEL_16(2, 0) }, { STREAM_SEL_16(2, 1) }, { STREAM_SEL_16(2, 2) } },
+};
+
+static const uint8_t lut_hi[16] __attribute__((aligned(16))) = { LUT_8(LUT_HI) };
+static const uint8_t lut_mid[16] __attribute__((aligned(16))) = { LUT_8(LUT_MID) };
+static const uint8_t lut_lo[16] __attribute__((aligned(16))) = { LUT_8(LUT_LO) };
+
+
+/*
+ * SSSE3 kernel, 16 color bytes to 12 words per iteration.  SSE2 alone has no byte
+ * shuffle, so pshufb is the baseline for the x86 paths.
+ */
+__attribute__((target("ssse3")))
+static void expand_ssse3(uint32_t *words, const uint8_t *bytes, int count)
+{
+    const __m128i hi_lut = _mm_load_si128((const __m128i *)lut_hi);
+    const __m128i mid_lut = _mm_load_si128((const __m128i *)lut_mid);
+    const __m128i lo_lut = _mm_load_si128((const __m128i *)lut_lo);
+    const __m128i mask3 = _mm_set1_epi8(0x07);
+    const __m128i mask2 = _mm_set1_epi8(0x03);
+    __m128i sel[3][3];
+    int i, v;
+
+    for (v = 0; v < 3; v++)
+    {
+        sel[v][0] = _mm_load_si128((const __m128i *)stream_sel[v][0]);
+        sel[v][1] = _mm_load_si128((const __m128i *)stream_sel[v][1]);
+        sel[v][2] = _mm_load_si128((const __m128i *)stream_sel[v][2]);
+    }
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        __m128i in = _mm_loadu_si128((const __m128i *)&bytes[i]);
+        __m128i hi = _mm_shuffle_epi8(hi_lut, _mm_and_si128(_mm_srli_epi16(in, 5), mask3));
+        __m128i mid = _mm_shuffle_epi8(mid_lut, _mm_and_si128(_mm_srli_epi16(in, 3), mask2));
+        __m128i lo = _mm_shuffle_epi8(lo_lut, _mm_and_si128(in, mask3));
+
+        for (v = 0; v < 3; v++)
+        {
+            __m128i out = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(hi, sel[v][0]),
+                                                    _mm_shuffle_epi8(mid, sel[v][1])),
+                                       _mm_shuffle_epi8(lo, sel[v][2]));
+
+            _mm_storeu_si128((__m128i *)&words[v * 4], out);
+        }
+        words += 12;
+    }
+
+    expand_scalar(words, &bytes[i], count - i);
+}
+
+/*
+ * AVX2 kernel, 32 color bytes to 24 words per iteration.  The byte shuffles only
+ * work within each 128-bit lane, so each lane expands its own 16 bytes exactly as
+ * the SSSE3 kernel does and the halves are put back in order on the way out.
+ */
+__attribute__((target("avx2")))
+static void expand_avx2(uint32_t *words, const uint8_t *bytes, int count)
+{
+    const __m256i hi_lut = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lut_hi));
+    const __m256i mid_lut = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lut_mid));
+    const __m256i lo_lut = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)lut_lo));
+    const __m256i mask3 = _mm256_set1_epi8(0x07);
+    const __m256i mask2 = _mm256_set1_epi8(0x03);
+    __m256i sel[3][3];
+    int i, v;
+
+    for (v = 0; v < 3; v++)
+    {
+        sel[v][0] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)stream_sel[v][0]));
+        sel[v][1] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)stream_sel[v][1]));
+        sel[v][2] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)stream_sel[v][2]));
+    }
+
+    for (i = 0; i + 32 <= count; i += 32)
+    {
+        __m256i in = _mm256_loadu_si256((const __m256i *)&bytes[i]);
+        __m256i hi = _mm256_shuffle_epi8(hi_lut, _mm256_and_si256(_mm256_srli_epi16(in, 5), mask3));
+        __m256i mid = _mm256_shuffle_epi8(mid_lut, _mm256_and_si256(_mm256_srli_epi16(in, 3), mask2));
+        __m256i lo = _mm256_shuffle_epi8(lo_lut, _mm256_and_si256(in, mask3));
+        __m256i out[3];
+
+        for (v = 0; v < 3; v++)
+        {
+            out[v] = _mm256_or_si256(_mm256_or_si256(_mm256_shuffle_epi8(hi, sel[v][0]),
+                                                     _mm256_shuffle_epi8(mid, sel[v][1])),
+                                     _mm256_shuffle_epi8(lo, sel[v][2]));
+        }
+
+        // Low lanes hold words 0-11, high lanes words 12-23
+        _mm256_storeu_si256((__m256i *)&words[0], _mm256_permute2x128_si256(out[0], out[1], 0x20));
+        _mm256_storeu_si256((__m256i *)&words[8], _mm256_permute2x128_si256(out[2], out[0], 0x30));
+        _mm256_storeu_si256((__m256i *)&words[16], _mm256_permute2x128_si256(out[1], out[2], 0x31));
+        words += 24;
+    }
+
+    // The compiler doesn't do this for us here, and the rest of the encoder is legacy
+    // SSE code that slows to a crawl while the upper halves are dirty
+    _mm256_zeroupper();
+
+    expand_ssse3(words, &bytes[i], count - i);
+}
+
+static int supported_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int supported_avx2(void)
+{
+    return __builtin_cpu_supports("avx2");
+}
+
+#endif /* x86 */
+
+
+#if defined(__aarch64__) || (defined(__arm__) && defined(__ARM_FP) && (__GNUC__ >= 8))
+
+#define ENCODE_NEON
+
+#include <sys/auxv.h>
+#include <arm_neon.h>
+
+#if defined(__aarch64__)
+#define NEON_TARGET
+#define HWCAP_NEON_PRESENT(hwcap)                1
+#else
+#define NEON_TARGET                              __attribute__((target("fpu=neon")))
+#define HWCAP_NEON_PRESENT(hwcap)                ((hwcap) & (1 << 12))   // HWCAP_NEON
+#endif
+
+static const uint8_t lut_hi_8[8] = { LUT_8(LUT_HI) };
+static const uint8_t lut_mid_8[8] = { LUT_8(LUT_MID) };
+static const uint8_t lut_lo_8[8] = { LUT_8(LUT_LO) };
+
+/*
+ * NEON kernel, 16 color bytes to 12 words per iteration.  The 3 way interleaving
+ * store puts the expansion bytes in stream order, then each word is byte swapped.
+ */
+NEON_TARGET
+static void expand_neon(uint32_t *words, const uint8_t *bytes, int count)
+{
+    const uint8x8_t hi_lut = vld1_u8(lut_hi_8);
+    const uint8x8_t mid_lut = vld1_u8(lut_mid_8);
+    const uint8x8_t lo_lut = vld1_u8(lut_lo_8);
+    const uint8x16_t mask3 = vdupq_n_u8(0x07);
+    const uint8x16_t mask2 = vdupq_n_u8(0x03);
+    uint8_t stream[48] __attribute__((aligned(16)));
+    int i;
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        uint8x16_t in = vld1q_u8(&bytes[i]);
+        uint8x16_t hi_idx = vshrq_n_u8(in, 5);
+        uint8x16_t mid_idx = vandq_u8(vshrq_n_u8(in, 3), mask2);
+        uint8x16_t lo_idx = vandq_u8(in, mask3);
+        uint8x16x3_t parts;
+
+        parts.val[0] = vcombine_u8(vtbl1_u8(hi_lut, vget_low_u8(hi_idx)),
+                                   vtbl1_u8(hi_lut, vget_high_u8(hi_idx)));
+        parts.val[1] = vcombine_u8(vtbl1_u8(mid_lut, vget_low_u8(mid_idx)),
+                                   vtbl1_u8(mid_lut, vget_high_u8(mid_idx)));
+        parts.val[2] = vcombine_u8(vtbl1_u8(lo_lut, vget_low_u8(lo_idx)),
+                                   vtbl1_u8(lo_lut, vget_high_u8(lo_idx)));
+
+        vst3q_u8(stream, parts);
+
+        vst1q_u8((uint8_t *)&words[0], vrev32q_u8(vld1q_u8(&stream[0])));
+        vst1q_u8((uint8_t *)&words[4], vrev32q_u8(vld1q_u8(&stream[16])));
+        vst1q_u8((uint8_t *)&words[8], vrev32q_u8(vld1q_u8(&stream[32])));
+        words += 12;
+    }
+
+    expand_scalar(words, &bytes[i], count - i);
+}
+
+static int supported_neon(void)
+{
+    unsigned long hwcap = getauxval(AT_HWCAP);
+
+    return HWCAP_NEON_PRESENT(hwcap) ? 1 : 0;
+}
+
+#endif /* NEON */
+
+
+// Slowest first, the scalar kernel is always available and is the default
+const encode_kernel_t encode_kernels[] =
+{
+    {
+        .name = "scalar",
+        .supported = supported_always,
+        .expand = expand_scalar,
+    },
+#ifdef ENCODE_NEON
+    {
+        .name = "neon",
+        .supported = supported_neon,
+        .expand = expand_neon,
+    },
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+    {
+        .name = "ssse3",
+        .supported = supported_ssse3,
+        .expand = expand_ssse3,
+    },
+    {
+        .name = "avx2",
+        .supported = supported_avx2,
+        .expand = expand_avx2,
+    },
+#endif
+    {
+        .name = NULL,
+    },
+};
+
+static const encode_kernel_t *encode_kernel = &encode_kernels[0];
+
+
+/**
+ * Pick the fastest kernel the CPU supports and use it from here on.
+ *
+ * @returns  The selected kernel.
+ */
+const encode_kernel_t *encode_kernel_detect(void)
+{
+    const encode_kernel_t *kernel;
+
+    for (kernel = encode_kernels; kernel->name; kernel++)
+    {
+        if (kernel->supported())
+        {
+            encode_kernel = kernel;
+        }
+    }
+
+    return encode_kernel;
+}
+
+/**
+ * Use the given kernel for all further encoding.  Mostly useful for testing and
+ * benchmarking, the caller must check kernel->supported() first.
+ *
+ * @param    kernel  One of the encode_kernels entries.
+ *
+ * @returns  None
+ */
+void encode_kernel_set(const encode_kernel_t *kernel)
+{
+    encode_kernel = kernel;
+}
+
+/**
+ * Return the kernel currently used by encode_channel().
+ *
+ * @returns  Kernel pointer.
+ */
+const encode_kernel_t *encode_kernel_get(void)
+{
+    return encode_kernel;
+}
+
+/*
+ * Encoders specialized for a color order.  Each one gathers the color bytes of
+ * LEDs in wire order, for the expansion kernels, and also turns them straight into
+ * words in word aligned mode.  ENCODER_ORDER() defines one with the positions of
+ * red, green and blue in an LED given as compile time constants, and one that skips
+ * the color correction lookups too, for tables that leave colors alone.
+ */
+#define COLOR_LUT(lut, index, value)             ((lut)->color[index][value])
+#define COLOR_DIRECT(lut, index, value)          ((void)(lut), (value))
+
+#define ENCODER(order, lookup, rshift, gshift, bshift)                                        \
+static void gather_##order(uint8_t *bytes, const ws2811_led_t *leds, int count,               \
+                          const encode_lut_t *lut)                                            \
+{                                                                                             \
+    int j;                                                                                    \
+                                                                                              \
+    for (j = 0; j < count; j++)                                                               \
+    {                                                                                         \
+        bytes[(j * 3) + 0] = lookup(lut, 0, (leds[j] >> (rshift)) & 0xff);                    \
+        bytes[(j * 3) + 1] = lookup(lut, 1, (leds[j] >> (gshift)) & 0xff);                    \
+        bytes[(j * 3) + 2] = lookup(lut, 2, (leds[j] >> (bshift)) & 0xff);                    \
+    }                                                                                         \
+}                                                                                             \
+                                                                                              \
+static void words4_##order(uint32_t *words, int stride, const ws2811_led_t *leds, int count,  \
+                          const encode_lut_t *lut)                                            \
+{                                                                                             \
+    int j;                                                                                    \
+                                                                                              \
+    for (j = 0; j < count; j++)                                                               \
+    {                                                                                         \
+        words[0 * stride] = encode_table4[lookup(lut, 0, (leds[j] >> (rshift)) & 0xff)];      \
+        words[1 * stride] = encode_table4[lookup(lut, 1, (leds[j] >> (gshift)) & 0xff)];      \
+        words[2 * stride] = encode_table4[lookup(lut, 2, (leds[j] >> (bshift)) & 0xff)];      \
+        words += 3 * stride;                                                                  \
+    }                                                                                         \
+}
+
+#define ENCODER_ORDER(order, strip)                                                           \
+ENCODER(order, COLOR_LUT, ((strip) >> 16) & 0xff, ((strip) >> 8) & 0xff, (strip) & 0xff)      \
+ENCODER(order##_direct, COLOR_DIRECT, ((strip) >> 16) & 0xff, ((strip) >> 8) & 0xff,          \
+        (strip) & 0xff)                                                                       \
+                                                                                              \
+static const encode_order_t order_##order =                                                   \
+{                                                                                             \
+    .name = #order,                                                                           \
+    .gather = gather_##order,                                                                 \
+    .words4 = words4_##order,                                                                 \
+};                                                                                            \
+                                                                                              \
+static const encode_order_t order_##order##_direct =                                          \
+{                                                                                             \
+    .name = #order " direct",                                                                 \
+    .gather = gather_##order##_direct,                                                        \
+    .words4 = words4_##order##_direct,                                                        \
+};
+
+ENCODER_ORDER(rgb, WS2811_STRIP_RGB)
+ENCODER_ORDER(rbg, WS2811_STRIP_RBG)
+ENCODER_ORDER(grb, WS2811_STRIP_GRB)
+ENCODER_ORDER(gbr, WS2811_STRIP_GBR)
+ENCODER_ORDER(brg, WS2811_STRIP_BRG)
+ENCODER_ORDER(bgr, WS2811_STRIP_BGR)
+
+// Any other strip type, with the shifts from the table
+ENCODER(shift, COLOR_LUT, lut->shift[0], lut->shift[1], lut->shift[2])
+
+const encode_order_t encode_order_shift =
+{
+    .name = "shift",
+    .gather = gather_shift,
+    .words4 = words4_shift,
+};
+
+static const struct
+{
+    int strip_type;
+    const encode_order_t *order;
+    const encode_order_t *direct;
+} encode_orders[] =
+{
+    { WS2811_STRIP_RGB, &order_rgb, &order_rgb_direct },
+    { WS2811_STRIP_RBG, &order_rbg, &order_rbg_direct },
+    { WS2811_STRIP_GRB, &order_grb, &order_grb_direct },
+    { WS2811_STRIP_GBR, &order_gbr, &order_gbr_direct },
+    { WS2811_STRIP_BRG, &order_brg, &order_brg_direct },
+    { WS2811_STRIP_BGR, &order_bgr, &order_bgr_direct },
+};
+
+/**
+ * Build the color correction table for a channel.  Each color value goes through
+ * the gamma curve, then the white balance gain for its color, then brightness.
+ * The gain and brightness steps scale the same way brightness always has, so with
+ * no gamma and no white balance the result is just the brightness scaling.  Also
+ * picks the encoder for the strip type and the resulting table.
+ *
+ * @param    lut            Table to fill in.
+ * @param    strip_type     Color order, one of the WS2811_STRIP_xxx constants.
+ * @param    brightness     Brightness value between 0 and 255.
+ * @param    gamma          Gamma exponent, 0 or 1.0 for a linear response.
+ * @param    white_balance  Gains as 0x00RRGGBB, 0 for no correction.
+ *
+ * @returns  None
+ */
+void encode_lut_build(encode_lut_t *lut, int strip_type, int brightness, float gamma,
+                      uint32_t white_balance)
+{
+    int scale = (brightness & 0xff) + 1;
+    int gain[3];
+    unsigned k;
+    int i, j;
+
+    if (!white_balance)
+    {
+        white_balance = 0xffffff;
+    }
+
+    gain[0] = ((white_balance >> 16) & 0xff) + 1;
+    gain[1] = ((white_balance >> 8)  & 0xff) + 1;
+    gain[2] = ((white_balance >> 0)  & 0xff) + 1;
+
+    for (i = 0; i < 256; i++)
+    {
+        int value = i;
+
+        if ((gamma > 0) && (gamma != 1.0))
+        {
+            value = (int)((pow(i / 255.0, gamma) * 255.0) + 0.5);
+        }
+
+        for (j = 0; j < 3; j++)
+        {
+            lut->color[j][i] = (((value * gain[j]) >> 8) * scale) >> 8;
+        }
+    }
+
+    lut->identity = 1;
+    for (j = 0; j < 3; j++)
+    {
+        for (i = 0; i < 256; i++)
+        {
+            if (lut->color[j][i] != i)
+            {
+                lut->identity = 0;
+            }
+        }
+    }
+
+    lut->shift[0] = (strip_type >> 16) & 0xff;
+    lut->shift[1] = (strip_type >> 8)  & 0xff;
+    lut->shift[2] = (strip_type >> 0)  & 0xff;
+    lut->order = &encode_order_shift;
+
+    for (k = 0; k < sizeof(encode_orders) / sizeof(encode_orders[0]); k++)
+    {
+        if (encode_orders[k].strip_type == strip_type)
+        {
+            lut->order = lut->identity ? encode_orders[k].direct : encode_orders[k].order;
+        }
+    }
+}
+
+/**
+ * Expand a chunk of LEDs of a channel into consecutive words.  The LEDs are turned
+ * into color corrected bytes in the order they go out on the wire, and then handed
+ * to the selected kernel, which expands every byte into its symbol bits and packs
+ * them MSB first into whole 32-bit words.
+ *
+ * @param    channel  Channel to encode.
+ * @param    lut      Color correction table for the channel.
+ * @param    first    First LED to encode.
+ * @param    count    Number of LEDs, at most ENCODE_CHUNK_LEDS.
+ * @param    words    Output, room for ENCODE_WORDS(count * 3) rounded up to 3 words.
+ *
+ * @returns  Number of output bits, the last word is partial unless this is a multiple of 32.
+ */
+static int expand_leds(const ws2811_channel_t *channel, const encode_lut_t *lut,
+                       int first, int count, uint32_t *words)
+{
+    uint8_t bytes[(ENCODE_CHUNK_LEDS * 3) + 4] __attribute__((aligned(16)));
+    int nbytes = count * 3;
+
+    lut->order->gather(bytes, &channel->leds[first], count, lut);
+
+    // Kernels take whole groups of 4 bytes, pad the last chunk out
+    memset(&bytes[nbytes], 0, 4);
+
+    encode_kernel->expand(words, bytes, (nbytes + 3) & ~0x3);
+
+    return nbytes * ENCODE_BYTE_BITS;
+}
+
+/**
+ * Merge the top bits of a trailing partial word, leaving the unused low bits untouched.
+ *
+ * @param    word   Output word.
+ * @param    value  Encoded word, only the top 'bits' bits are valid.
+ * @param    bits   Number of valid bits, 1 to 31.
+ *
+ * @returns  None
+ */
+static inline void merge_partial(uint32_t *word, uint32_t value, int bits)
+{
+    uint32_t mask = 0xffffffff >> bits;
+
+    *word = (*word & mask) | (value & ~mask);
+}
+
+/**
+ * Encode the LEDs of a single channel into PWM serializer words.
+ *
+ * Only LEDs [first, first + count) are encoded.  A range starting on a multiple of
+ * 4 LEDs starts on a word boundary, so the words of the LEDs around it are left alone.
+ *
+ * @param    channel  Channel to encode.
+ * @param    lut      Color correction table for the channel.
+ * @param    words    First output word for this channel.
+ * @param    stride   Distance in words between consecutive words of this channel.
+ * @param    first    First LED to encode, a multiple of 4.
+ * @param    count    Number of LEDs to encode.
+ *
+ * @returns  None
+ */
+void encode_channel(const ws2811_channel_t *channel, const encode_lut_t *lut,
+                    uint32_t *words, int stride, int first, int count)
+{
+    uint32_t chunk[ENCODE_WORDS(ENCODE_CHUNK_LEDS * 3) + 3] __attribute__((aligned(16)));
+    int end = first + count;
+    int i, j;
+
+    words += ENCODE_WORDS(first * 3) * stride;
+
+    for (i = first; i < end; i += ENCODE_CHUNK_LEDS)
+    {
+        int nbits, nwords;
+
+        count = end - i;
+        if (count > ENCODE_CHUNK_LEDS)
+        {
+            count = ENCODE_CHUNK_LEDS;
+        }
+
+        // Full chunks always end on a word boundary and can go straight to the output
+        if ((stride == 1) && (count == ENCODE_CHUNK_LEDS))
+        {
+            nbits = expand_leds(channel, lut, i, count, words);
+            words += nbits / 32;
+            continue;
+        }
+
+        nbits = expand_leds(channel, lut, i, count, chunk);
+        nwords = nbits / 32;
+
+        for (j = 0; j < nwords; j++)
+        {
+            words[j * stride] = chunk[j];
+        }
+
+        if (nbits % 32)
+        {
+            merge_partial(&words[nwords * stride], chunk[nwords], nbits % 32);
+        }
+
+        words += nwords * stride;
+    }
+}
+
+/**
+ * Encode the LEDs of both channels into the interleaved layout the PWM FIFO expects,
+ * word 0 of channel 0, word 0 of channel 1, word 1 of channel 0 and so on.  Both
+ * channels are expanded a chunk at a time into scratch space and then written out
+ * together, so the output is filled in a single ascending pass, a pair of words at a
+ * time, rather than once per channel with gaps in between.
+ *
+ * Only LEDs [first, first + count) are encoded, clipped to the length of each
+ * channel.  As with encode_channel() the range must start on a multiple of 4 LEDs.
+ *
+ * @param    channels  Both channels.
+ * @param    luts      Color correction tables, one per channel.
+ * @param    words     First output word.
+ * @param    first     First LED to encode, a multiple of 4.
+ * @param    count     Number of LEDs to encode.
+ *
+ * @returns  None
+ */
+void encode_channels(const ws2811_channel_t *channels, const encode_lut_t *luts,
+                     uint32_t *words, int first, int count)
+{
+    uint32_t chunk[RPI_PWM_CHANNELS][ENCODE_WORDS(ENCODE_CHUNK_LEDS * 3) + 3]
+        __attribute__((aligned(16)));
+    int end = first + count;
+    int i, j, chan;
+
+    for (i = first; i < end; i += ENCODE_CHUNK_LEDS)
+    {
+        uint32_t *out = &words[ENCODE_WORDS(i * 3) * RPI_PWM_CHANNELS];
+        int nbits[RPI_PWM_CHANNELS];
+        int nwords[RPI_PWM_CHANNELS];
+        int pairs;
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            int leds = channels[chan].count;
+
+            if (leds > end)
+            {
+                leds = end;
+            }
+
+            leds -= i;
+            if (leds > ENCODE_CHUNK_LEDS)
+            {
+                leds = ENCODE_CHUNK_LEDS;
+            }
+
+            nbits[chan] = 0;
+            if (leds > 0)
+            {
+                nbits[chan] = expand_leds(&channels[chan], &luts[chan], i, leds, chunk[chan]);
+            }
+            nwords[chan] = nbits[chan] / 32;
+        }
+
+        // Word pairs where both channels have data
+        pairs = (nwords[0] < nwords[1]) ? nwords[0] : nwords[1];
+        for (j = 0; j < pairs; j++)
+        {
+            out[(j * RPI_PWM_CHANNELS) + 0] = chunk[0][j];
+            out[(j * RPI_PWM_CHANNELS) + 1] = chunk[1][j];
+        }
+
+        // Whatever is left of the longer channel
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            for (j = pairs; j < nwords[chan]; j++)
+            {
+                out[(j * RPI_PWM_CHANNELS) + chan] = chunk[chan][j];
+            }
+
+            if (nbits[chan] % 32)
+            {
+                merge_partial(&out[(nwords[chan] * RPI_PWM_CHANNELS) + chan], chunk[chan][nwords[chan]],
+                              nbits[chan] % 32);
+            }
+        }
+    }
+}
+
+/**
+ * Encode the LEDs of a single channel in word aligned mode, with 4 symbols per bit,
+ * into consecutive words.
+ *
+ * @param    channel  Channel to encode.
+ * @param    lut      Color correction table for the channel.
+ * @param    words    First output word for this channel.
+ * @param    first    First LED to encode.
+ * @param    count    Number of LEDs to encode.
+ *
+ * @returns  None
+ */
+void encode_channel4(const ws2811_channel_t *channel, const encode_lut_t *lut,
+                     uint32_t *words, int first, int count)
+{
+    lut->order->words4(&words[first * 3], 1, &channel->leds[first], count, lut);
+}
+
+/**
+ * Encode the LEDs of both channels in word aligned mode, with 4 symbols per bit.
+ * Every color byte is exactly one word, so there are no partial words to merge and
+ * no expansion kernels to run, just a table store per byte into the interleaved
+ * layout.
+ *
+ * Only LEDs [first, first + count) are encoded, clipped to the length of each
+ * channel.  The range may start at any LED.
+ *
+ * @param    channels  Both channels.
+ * @param    luts      Color correction tables, one per channel.
+ * @param    words     First output word.
+ * @param    first     First LED to encode.
+ * @param    count     Number of LEDs to encode.
+ *
+ * @returns  None
+ */
+void encode_channels4(const ws2811_channel_t *channels, const encode_lut_t *luts,
+                      uint32_t *words, int first, int count)
+{
+    int end = first + count;
+    int i, chan;
+
+    for (i = first; i < end; i += ENCODE_CHUNK_LEDS)
+    {
+        uint32_t *out = &words[i * 3 * RPI_PWM_CHANNELS];
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            int leds = (channels[chan].count < end) ? channels[chan].count : end;
+
+            leds -= i;
+            if (leds > ENCODE_CHUNK_LEDS)
+            {
+                leds = ENCODE_CHUNK_LEDS;
+            }
+
+            if (leds > 0)
+            {
+                luts[chan].order->words4(&out[chan], RPI_PWM_CHANNELS, &channels[chan].leds[i],
+                                         leds, &luts[chan]);
+            }
+        }
+    }
+}
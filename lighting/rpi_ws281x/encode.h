@@ -0,0 +1,124 @@
+/*
+ * encode.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __ENCODE_H__
+#define __ENCODE_H__
+
+#include "ws2811.h"
+
+
+#define SYMBOL_HIGH                              0x6  // 1 1 0
+#define SYMBOL_LOW                               0x4  // 1 0 0
+
+// Word aligned mode, 4 symbols per bit
+#define SYMBOL4_HIGH                             0xc  // 1 1 0 0
+#define SYMBOL4_LOW                              0x8  // 1 0 0 0
+
+
+// Each color byte expands to 8 data bits of 3 symbols each
+#define ENCODE_BYTE_BITS                         24
+
+// Output words for a number of color bytes, rounded up
+#define ENCODE_WORDS(bytes)                      ((((bytes) * ENCODE_BYTE_BITS) + 31) / 32)
+
+// LEDs handed to the expansion kernel at a time, a multiple of 32 color bytes
+#define ENCODE_CHUNK_LEDS                        64
+
+// Encoding can start at any multiple of this many LEDs, 4 LEDs are exactly 9 words
+#define ENCODE_ALIGN_LEDS                        4
+
+
+struct encode_lut;
+
+/*
+ * Encoder for a strip color order.  gather() puts the color corrected bytes of
+ * 'count' LEDs into 'bytes', in the order they go out on the wire, for the
+ * expansion kernel.  words4() encodes them in word aligned mode, one word per color
+ * byte, 'stride' words apart.
+ */
+typedef struct
+{
+    const char *name;
+    void (*gather)(uint8_t *bytes, const ws2811_led_t *leds, int count,
+                   const struct encode_lut *lut);
+    void (*words4)(uint32_t *words, int stride, const ws2811_led_t *leds, int count,
+                   const struct encode_lut *lut);
+} encode_order_t;
+
+/*
+ * Color correction applied to each color byte before it is expanded.  Combines
+ * gamma, white balance gain and brightness in a single lookup per byte, and picks
+ * the encoder for the strip type.  There is one per color order, with its shifts
+ * known at compile time, and one more each that skips the lookups when the table
+ * leaves colors alone, as it does at full brightness without any correction.
+ */
+typedef struct encode_lut
+{
+    uint8_t color[3][256];                       // Red, green, blue
+    int shift[3];                                // Position of each color in an LED
+    int identity;                                // Table maps every value to itself
+    const encode_order_t *order;
+} encode_lut_t;
+
+/*
+ * Expansion kernel.  Expands 'count' color bytes, a multiple of 4, into
+ * (count * 3 / 4) consecutive output words.
+ */
+typedef struct
+{
+    const char *name;
+    int (*supported)(void);
+    void (*expand)(uint32_t *words, const uint8_t *bytes, int count);
+} encode_kernel_t;
+
+
+extern const uint32_t encode_table[256];
+extern const uint32_t encode_table4[256];
+extern const encode_kernel_t encode_kernels[];   // Slowest first, NULL name terminated
+extern const encode_order_t encode_order_shift;  // Any color order, shifts at run time
+
+
+const encode_kernel_t *encode_kernel_detect(void);
+void encode_kernel_set(const encode_kernel_t *kernel);
+const encode_kernel_t *encode_kernel_get(void);
+
+void encode_lut_build(encode_lut_t *lut, int strip_type, int brightness, float gamma,
+                      uint32_t white_balance);
+void encode_channel(const ws2811_channel_t *channel, const encode_lut_t *lut,
+                    uint32_t *words, int stride, int first, int count);
+void encode_channels(const ws2811_channel_t *channels, const encode_lut_t *luts,
+                     uint32_t *words, int first, int count);
+void encode_channel4(const ws2811_channel_t *channel, const encode_lut_t *lut,
+                     uint32_t *words, int first, int count);
+void encode_channels4(const ws2811_channel_t *channels, const encode_lut_t *luts,
+                      uint32_t *words, int first, int count);
+
+
+#endif /* __ENCODE_H__ */
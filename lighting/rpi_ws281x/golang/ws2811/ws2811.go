@@ -28,36 +28,75 @@ Interface to ws2811 chip (neopixel driver). Make sure that you have
 ws2811.h and pwm.h in a GCC include path (e.g. /usr/local/include) and
 libws2811.a in a GCC library path (e.g. /usr/local/lib).
 See https://github.com/jgarff/rpi_ws281x for instructions
+
+The package level functions drive a single global controller.  New returns a
+controller of its own, with direct access to its LED buffers, and can render
+from a separate goroutine.  Only one controller, global or not, can be
+initialized at a time: they would all share the one PWM peripheral.
 */
 
 package ws2811
 
 /*
 #cgo CFLAGS: -std=c99
-#cgo LDFLAGS: -lws2811
+#cgo LDFLAGS: -lws2811 -lm
 #include "ws2811.go.h"
 */
 import "C"
 import (
 	"errors"
 	"fmt"
+	"sync"
 	"unsafe"
 )
 
+// The controller driving the hardware.  All of them share the PWM peripheral, its
+// clock and FIFO, and the library's encoder selection, so there can only be one.
+var (
+	hwLock  sync.Mutex
+	hwOwner *C.ws2811_t
+)
+
+func hwAcquire(dev *C.ws2811_t) error {
+	hwLock.Lock()
+	defer hwLock.Unlock()
+
+	if hwOwner != nil {
+		return errors.New("Error ws2811.init: another controller is initialized")
+	}
+	hwOwner = dev
+
+	return nil
+}
+
+func hwRelease(dev *C.ws2811_t) {
+	hwLock.Lock()
+	defer hwLock.Unlock()
+
+	if hwOwner == dev {
+		hwOwner = nil
+	}
+}
+
 func Init(gpioPin int, ledCount int, brightness int) error {
 	C.ledstring.channel[0].gpionum = C.int(gpioPin)
 	C.ledstring.channel[0].count = C.int(ledCount)
 	C.ledstring.channel[0].brightness = C.int(brightness)
+	if err := hwAcquire(&C.ledstring); err != nil {
+		return err
+	}
 	res := int(C.ws2811_init(&C.ledstring))
 	if res == 0 {
 		return nil
 	} else {
+		hwRelease(&C.ledstring)
 		return errors.New(fmt.Sprintf("Error ws2811.init.%d", res))
 	}
 }
 
 func Fini() {
 	C.ws2811_fini(&C.ledstring)
+	hwRelease(&C.ledstring)
 }
 
 func Render() error {
@@ -89,3 +128,186 @@ func Clear() {
 func SetBitmap(a []uint32) {
 	C.ws2811_set_bitmap(&C.ledstring, unsafe.Pointer(&a[0]), C.int(len(a)*4))
 }
+
+// ChannelOption configures one PWM channel of a WS2811 instance.
+type ChannelOption struct {
+	GpioPin    int  // GPIO pin with PWM alternate function, 0 if unused
+	LedCount   int  // Number of LEDs, 0 if the channel is unused
+	Brightness int  // Between 0 and 255
+	Invert     bool // Invert the output signal
+	StripType  int  // Color order, 0 for the library default
+}
+
+// Option configures a WS2811 instance.
+type Option struct {
+	Frequency int // Output frequency, 800000 for most LEDs
+	DmaNum    int // DMA channel
+	Channels  [C.RPI_PWM_CHANNELS]ChannelOption
+}
+
+// DefaultOptions are the settings of the package level functions.
+var DefaultOptions = Option{
+	Frequency: 800000,
+	DmaNum:    5,
+	Channels: [C.RPI_PWM_CHANNELS]ChannelOption{
+		{GpioPin: 18, LedCount: 256, Brightness: 32},
+	},
+}
+
+// WS2811 is an LED controller with its own ws2811_t.  Only one controller can be
+// initialized at a time, as they all share the PWM peripheral, its clock and FIFO,
+// and the library's encoder selection, whatever their DMA channels.  Its methods
+// must not be called from several goroutines at once.
+type WS2811 struct {
+	dev   *C.ws2811_t
+	frame *C.ws2811_t   // Snapshot the render goroutine renders from
+	queue chan struct{} // Snapshot ready
+	done  chan error    // Snapshot rendered
+	busy  bool          // Render goroutine has a snapshot
+}
+
+// New sets up a controller with the given options.  Call Init before using it.
+func New(opt *Option) (*WS2811, error) {
+	dev := (*C.ws2811_t)(C.calloc(1, C.size_t(unsafe.Sizeof(C.ws2811_t{}))))
+	if dev == nil {
+		return nil, errors.New("Error ws2811.new")
+	}
+
+	dev.freq = C.uint32_t(opt.Frequency)
+	dev.dmanum = C.int(opt.DmaNum)
+	for i, ch := range opt.Channels {
+		dev.channel[i].gpionum = C.int(ch.GpioPin)
+		dev.channel[i].count = C.int(ch.LedCount)
+		dev.channel[i].brightness = C.int(ch.Brightness)
+		dev.channel[i].strip_type = C.int(ch.StripType)
+		if ch.Invert {
+			dev.channel[i].invert = 1
+		}
+	}
+
+	return &WS2811{dev: dev}, nil
+}
+
+// Init sets up the hardware and allocates the LED buffers.  It fails while another
+// controller is initialized.
+func (ws *WS2811) Init() error {
+	if err := hwAcquire(ws.dev); err != nil {
+		return err
+	}
+	res := int(C.ws2811_init(ws.dev))
+	if res == 0 {
+		return nil
+	} else {
+		hwRelease(ws.dev)
+		return errors.New(fmt.Sprintf("Error ws2811.init.%d", res))
+	}
+}
+
+// Fini waits for frames passed to Show, releases the hardware and frees the
+// controller.  It can't be used afterwards.
+func (ws *WS2811) Fini() {
+	if ws.queue != nil {
+		ws.Sync()
+		close(ws.queue)
+		C.ws2811_snapshot_free(ws.frame)
+		C.free(unsafe.Pointer(ws.frame))
+		ws.queue = nil
+	}
+
+	C.ws2811_fini(ws.dev)
+	hwRelease(ws.dev)
+	C.free(unsafe.Pointer(ws.dev))
+	ws.dev = nil
+}
+
+// Render sends the LEDs to the hardware, waiting for the previous frame to be out.
+func (ws *WS2811) Render() error {
+	res := int(C.ws2811_render(ws.dev))
+	if res == 0 {
+		return nil
+	} else {
+		return errors.New(fmt.Sprintf("Error ws2811.render.%d", res))
+	}
+}
+
+// Wait waits for the last frame sent by Render to be out.
+func (ws *WS2811) Wait() error {
+	res := int(C.ws2811_wait(ws.dev))
+	if res == 0 {
+		return nil
+	} else {
+		return errors.New(fmt.Sprintf("Error ws2811.wait.%d", res))
+	}
+}
+
+// Leds returns the LED buffer of a channel, 0x00RRGGBB per LED.  Writing to it
+// changes the next frame directly, without any cgo call.  It's valid from Init to
+// Fini.
+func (ws *WS2811) Leds(channel int) []uint32 {
+	ch := &ws.dev.channel[channel]
+	if ch.leds == nil {
+		return nil
+	}
+
+	count := int(ch.count)
+	return (*[1 << 28]uint32)(unsafe.Pointer(ch.leds))[:count:count]
+}
+
+// SetLeds copies the colors of a whole channel in one go.
+func (ws *WS2811) SetLeds(channel int, leds []uint32) error {
+	if copy(ws.Leds(channel), leds) != len(leds) {
+		return errors.New(fmt.Sprintf("Error ws2811.setleds.%d", len(leds)))
+	}
+	return nil
+}
+
+func (ws *WS2811) renderLoop() {
+	for range ws.queue {
+		res := int(C.ws2811_render(ws.frame))
+		if res == 0 {
+			ws.done <- nil
+		} else {
+			ws.done <- errors.New(fmt.Sprintf("Error ws2811.render.%d", res))
+		}
+	}
+}
+
+// Show copies the LEDs and has them rendered by a separate goroutine, so the next
+// frame can be drawn while this one is encoded and sent.  It only waits while the
+// previous frame hasn't been handed to the hardware yet, and returns its error, if
+// any.  Don't mix it with Render.
+func (ws *WS2811) Show() error {
+	var err error
+
+	if ws.queue == nil {
+		ws.frame = (*C.ws2811_t)(C.calloc(1, C.size_t(unsafe.Sizeof(C.ws2811_t{}))))
+		if ws.frame == nil {
+			return errors.New("Error ws2811.show")
+		}
+		ws.queue = make(chan struct{}, 1)
+		ws.done = make(chan error, 1)
+		go ws.renderLoop()
+	}
+
+	err = ws.Sync()
+
+	if C.ws2811_snapshot(ws.frame, ws.dev) != 0 {
+		return errors.New("Error ws2811.show")
+	}
+
+	ws.busy = true
+	ws.queue <- struct{}{}
+
+	return err
+}
+
+// Sync waits until the last frame passed to Show has been handed to the hardware,
+// and returns its error, if any.
+func (ws *WS2811) Sync() error {
+	if !ws.busy {
+		return nil
+	}
+
+	ws.busy = false
+	return <-ws.done
+}
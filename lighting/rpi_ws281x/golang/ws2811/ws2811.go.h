@@ -26,6 +26,7 @@
  ***********************************************************************************/
  
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ws2811.h>
 
@@ -62,3 +63,40 @@ void ws2811_clear(ws2811_t *ws2811) {
 void ws2811_set_bitmap(ws2811_t *ws2811, void* a, int len) {
 	memcpy(ws2811->channel[0].leds, a, len);
 }
+
+/*
+ * Copy the settings and LEDs of an instance into a snapshot to render from.  The
+ * device state is shared, so rendering the snapshot is the same as rendering the
+ * instance itself.
+ */
+int ws2811_snapshot(ws2811_t *dst, const ws2811_t *src) {
+	ws2811_led_t *leds[RPI_PWM_CHANNELS];
+
+	for (int chan = 0; chan < RPI_PWM_CHANNELS; chan++) {
+		leds[chan] = realloc(dst->channel[chan].leds,
+		                     sizeof(ws2811_led_t) * (src->channel[chan].count + 1));
+		if (!leds[chan]) {
+			return -1;
+		}
+		dst->channel[chan].leds = leds[chan];
+	}
+
+	*dst = *src;
+
+	for (int chan = 0; chan < RPI_PWM_CHANNELS; chan++) {
+		dst->channel[chan].leds = leds[chan];
+		if (src->channel[chan].count) {
+			memcpy(leds[chan], src->channel[chan].leds,
+			       sizeof(ws2811_led_t) * src->channel[chan].count);
+		}
+	}
+
+	return 0;
+}
+
+void ws2811_snapshot_free(ws2811_t *snapshot) {
+	for (int chan = 0; chan < RPI_PWM_CHANNELS; chan++) {
+		free(snapshot->channel[chan].leds);
+		snapshot->channel[chan].leds = NULL;
+	}
+}
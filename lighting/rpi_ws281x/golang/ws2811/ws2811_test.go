@@ -0,0 +1,122 @@
+// Copyright (c) 2015, Jacques Supcik, HEIA-FR
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met:
+//     * Redistributions of source code must retain the above copyright
+//       notice, this list of conditions and the following disclaimer.
+//     * Redistributions in binary form must reproduce the above copyright
+//       notice, this list of conditions and the following disclaimer in the
+//       documentation and/or other materials provided with the distribution.
+//     * Neither the name of the <organization> nor the
+//       names of its contributors may be used to endorse or promote products
+//       derived from this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+// ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+// WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED. IN NO EVENT SHALL <COPYRIGHT HOLDER> BE LIABLE FOR ANY
+// DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+// (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+// LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+// ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+// SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+package ws2811
+
+import (
+	"testing"
+)
+
+// The benchmarks need the hardware, so they run as root on a Raspberry Pi and are
+// skipped elsewhere.  Each iteration is one frame.
+
+func benchInstance(b *testing.B, count int) (*WS2811, []uint32) {
+	opt := DefaultOptions
+	opt.Channels[0].LedCount = count
+	opt.Channels[0].Brightness = 255
+
+	ws, err := New(&opt)
+	if err != nil {
+		b.Fatal(err)
+	}
+
+	if err := ws.Init(); err != nil {
+		b.Skip(err)
+	}
+
+	return ws, make([]uint32, count)
+}
+
+// One cgo call per LED, with the package level functions
+func benchSetLed(b *testing.B, count int) {
+	if err := Init(18, count, 255); err != nil {
+		b.Skip(err)
+	}
+	defer Fini()
+
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := 0; i < count; i++ {
+			SetLed(i, uint32(n+i))
+		}
+	}
+}
+
+func benchSetLeds(b *testing.B, count int) {
+	ws, frame := benchInstance(b, count)
+	defer ws.Fini()
+
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := range frame {
+			frame[i] = uint32(n + i)
+		}
+		ws.SetLeds(0, frame)
+	}
+}
+
+func benchRender(b *testing.B, count int) {
+	ws, frame := benchInstance(b, count)
+	defer ws.Fini()
+
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := range frame {
+			frame[i] = uint32(n + i)
+		}
+		ws.SetLeds(0, frame)
+		if err := ws.Render(); err != nil {
+			b.Fatal(err)
+		}
+	}
+}
+
+func benchShow(b *testing.B, count int) {
+	ws, frame := benchInstance(b, count)
+	defer ws.Fini()
+
+	b.ResetTimer()
+	for n := 0; n < b.N; n++ {
+		for i := range frame {
+			frame[i] = uint32(n + i)
+		}
+		ws.SetLeds(0, frame)
+		if err := ws.Show(); err != nil {
+			b.Fatal(err)
+		}
+	}
+	if err := ws.Sync(); err != nil {
+		b.Fatal(err)
+	}
+}
+
+func BenchmarkSetLed1k(b *testing.B)   { benchSetLed(b, 1000) }
+func BenchmarkSetLed10k(b *testing.B)  { benchSetLed(b, 10000) }
+func BenchmarkSetLeds1k(b *testing.B)  { benchSetLeds(b, 1000) }
+func BenchmarkSetLeds10k(b *testing.B) { benchSetLeds(b, 10000) }
+func BenchmarkRender1k(b *testing.B)   { benchRender(b, 1000) }
+func BenchmarkRender10k(b *testing.B)  { benchRender(b, 10000) }
+func BenchmarkShow1k(b *testing.B)     { benchShow(b, 1000) }
+func BenchmarkShow10k(b *testing.B)    { benchShow(b, 10000) }
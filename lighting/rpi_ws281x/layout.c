@@ -0,0 +1,381 @@
+/*
+ * layout.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ws2811.h"
+#include "layout.h"
+
+
+#define PIXEL_NONE                               -1           // LED not on any panel, left alone
+#define PIXEL_BLACK                              -2           // Gap LED, kept black
+
+
+/**
+ * Find where an LED of a panel shows up in the framebuffer.
+ *
+ * @param    panel   Panel.
+ * @param    line    Row, or column when wired in columns, in wiring order.
+ * @param    pos     LED within the line, in wiring order.
+ * @param    width   Framebuffer width.
+ * @param    height  Framebuffer height.
+ *
+ * @returns  Pixel index, PIXEL_NONE if it's outside of the framebuffer.
+ */
+static int panel_pixel(const ws2811_panel_t *panel, int line, int pos, int width, int height)
+{
+    int len = (panel->flags & WS2811_LAYOUT_COLUMNS) ? panel->height : panel->width;
+    int px, py, fx, fy;
+
+    if ((panel->flags & WS2811_LAYOUT_SERPENTINE) && (line & 1))
+    {
+        pos = len - 1 - pos;
+    }
+
+    if (panel->flags & WS2811_LAYOUT_COLUMNS)
+    {
+        px = line;
+        py = pos;
+    }
+    else
+    {
+        px = pos;
+        py = line;
+    }
+
+    if (panel->flags & WS2811_LAYOUT_MIRROR_X)
+    {
+        px = panel->width - 1 - px;
+    }
+    if (panel->flags & WS2811_LAYOUT_MIRROR_Y)
+    {
+        py = panel->height - 1 - py;
+    }
+
+    switch (panel->rotation)
+    {
+        case 90:
+            fx = panel->height - 1 - py;
+            fy = px;
+            break;
+
+        case 180:
+            fx = panel->width - 1 - px;
+            fy = panel->height - 1 - py;
+            break;
+
+        case 270:
+            fx = py;
+            fy = panel->width - 1 - px;
+            break;
+
+        default:
+            fx = px;
+            fy = py;
+            break;
+    }
+
+    fx += panel->x;
+    fy += panel->y;
+
+    if ((fx < 0) || (fx >= width) || (fy < 0) || (fy >= height))
+    {
+        return PIXEL_NONE;
+    }
+
+    return (fy * width) + fx;
+}
+
+/**
+ * Fill in the pixel of every LED a panel covers.
+ *
+ * @param    panel   Panel.
+ * @param    map     Pixel per LED of the panel's channel.
+ * @param    count   LEDs on the channel.
+ * @param    width   Framebuffer width.
+ * @param    height  Framebuffer height.
+ *
+ * @returns  0 on success, -1 if the panel doesn't fit on the channel.
+ */
+static int panel_map(const ws2811_panel_t *panel, int32_t *map, int count, int width,
+                     int height)
+{
+    int lines = (panel->flags & WS2811_LAYOUT_COLUMNS) ? panel->width : panel->height;
+    int len = (panel->flags & WS2811_LAYOUT_COLUMNS) ? panel->height : panel->width;
+    int led = panel->first;
+    int line, pos, i;
+
+    if ((panel->width <= 0) || (panel->height <= 0) || (panel->gap < 0) ||
+        (panel->first < 0) ||
+        (((int64_t)lines * len) + ((int64_t)(lines - 1) * panel->gap) >
+         (count - panel->first)) ||
+        (panel->rotation % 90) || (panel->rotation < 0) || (panel->rotation > 270))
+    {
+        return -1;
+    }
+
+    for (line = 0; line < lines; line++)
+    {
+        if (line)
+        {
+            for (i = 0; i < panel->gap; i++)
+            {
+                map[led++] = PIXEL_BLACK;
+            }
+        }
+
+        for (pos = 0; pos < len; pos++)
+        {
+            map[led++] = panel_pixel(panel, line, pos, width, height);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Append a run to the layout, growing the array as needed.
+ *
+ * @param    layout  Layout.
+ * @param    run     Run to append.
+ *
+ * @returns  0 on success, -1 if out of memory.
+ */
+static int layout_append(ws2811_layout_t *layout, const ws2811_layout_run_t *run)
+{
+    // Grow by doubling, runs + 1 is a power of 2 whenever the array is full
+    if (!(layout->runs & (layout->runs + 1)) || !layout->runs)
+    {
+        ws2811_layout_run_t *grown;
+
+        grown = realloc(layout->run, ((layout->runs * 2) + 1) * sizeof(*grown));
+        if (!grown)
+        {
+            return -1;
+        }
+        layout->run = grown;
+    }
+
+    layout->run[layout->runs++] = *run;
+
+    return 0;
+}
+
+/**
+ * Turn a channel's pixel per LED into runs of evenly spaced pixels.
+ *
+ * @param    layout  Layout to add the runs to.
+ * @param    chan    Channel number.
+ * @param    map     Pixel per LED.
+ * @param    count   Number of LEDs.
+ *
+ * @returns  0 on success, -1 if out of memory.
+ */
+static int layout_runs(ws2811_layout_t *layout, int chan, const int32_t *map, int count)
+{
+    int led = 0;
+
+    while (led < count)
+    {
+        ws2811_layout_run_t run =
+        {
+            .channel = chan,
+            .led = led,
+            .count = 1,
+            .src = map[led],
+            .step = 0,
+        };
+
+        if (map[led] == PIXEL_NONE)
+        {
+            led++;
+            continue;
+        }
+
+        if (map[led] == PIXEL_BLACK)
+        {
+            run.src = -1;
+            while (((led + run.count) < count) && (map[led + run.count] == PIXEL_BLACK))
+            {
+                run.count++;
+            }
+        }
+        else if (((led + 1) < count) && (map[led + 1] >= 0))
+        {
+            run.step = map[led + 1] - map[led];
+            while (((led + run.count) < count) && (map[led + run.count] >= 0) &&
+                   ((map[led + run.count] - map[led + run.count - 1]) == run.step))
+            {
+                run.count++;
+            }
+        }
+
+        if (layout_append(layout, &run))
+        {
+            return -1;
+        }
+
+        led += run.count;
+    }
+
+    return 0;
+}
+
+/**
+ * Compile a description of the panels into a layout.  Panels may overlap in the
+ * framebuffer, so mirrored displays are possible, but not on the wire.  LEDs of
+ * the channels that no panel covers are left alone by ws2811_layout_blit().
+ *
+ * @param    layout  Layout to fill in.
+ * @param    ws2811  ws2811 instance the LEDs belong to, for the channel sizes.
+ * @param    width   Framebuffer width in pixels.
+ * @param    height  Framebuffer height in pixels.
+ * @param    panels  Panels.
+ * @param    count   Number of panels.
+ *
+ * @returns  0 on success, -1 if a panel doesn't fit on its channel or out of memory.
+ */
+int ws2811_layout_create(ws2811_layout_t *layout, ws2811_t *ws2811, int width, int height,
+                         const ws2811_panel_t *panels, int count)
+{
+    int32_t *map[RPI_PWM_CHANNELS] = { NULL };
+    int chan, i;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->width = width;
+    layout->height = height;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        int leds = ws2811->channel[chan].count;
+
+        map[chan] = malloc((leds ? leds : 1) * sizeof(int32_t));
+        if (!map[chan])
+        {
+            goto err;
+        }
+
+        for (i = 0; i < leds; i++)
+        {
+            map[chan][i] = PIXEL_NONE;
+        }
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        chan = panels[i].channel;
+
+        if ((chan < 0) || (chan >= RPI_PWM_CHANNELS) ||
+            panel_map(&panels[i], map[chan], ws2811->channel[chan].count, width, height))
+        {
+            goto err;
+        }
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (layout_runs(layout, chan, map[chan], ws2811->channel[chan].count))
+        {
+            goto err;
+        }
+        free(map[chan]);
+        map[chan] = NULL;
+    }
+
+    return 0;
+
+err:
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        free(map[chan]);
+    }
+    ws2811_layout_free(layout);
+
+    return -1;
+}
+
+/**
+ * Free a layout's runs.
+ *
+ * @param    layout  Layout from ws2811_layout_create().
+ *
+ * @returns  None
+ */
+void ws2811_layout_free(ws2811_layout_t *layout)
+{
+    free(layout->run);
+    layout->run = NULL;
+    layout->runs = 0;
+}
+
+/**
+ * Copy a framebuffer onto the LEDs.  Every run is a straight copy, a reversed copy,
+ * or a strided one, each a simple loop the compiler can vectorize.
+ *
+ * @param    layout  Layout from ws2811_layout_create().
+ * @param    ws2811  ws2811 instance to draw into.
+ * @param    fb      Row major framebuffer of layout->width * layout->height pixels.
+ *
+ * @returns  None
+ */
+void ws2811_layout_blit(ws2811_layout_t *layout, ws2811_t *ws2811, const ws2811_led_t *fb)
+{
+    int r;
+
+    for (r = 0; r < layout->runs; r++)
+    {
+        const ws2811_layout_run_t *run = &layout->run[r];
+        ws2811_led_t *leds = &ws2811->channel[run->channel].leds[run->led];
+
+        if (run->src < 0)
+        {
+            memset(leds, 0, run->count * sizeof(*leds));
+        }
+        else if (run->step == 1)
+        {
+            memcpy(leds, &fb[run->src], run->count * sizeof(*leds));
+        }
+        else
+        {
+            const ws2811_led_t *src = &fb[run->src];
+            ws2811_led_t *end = leds + run->count;
+            int32_t step = run->step;
+
+            while (leds < end)
+            {
+                *leds++ = *src;
+                src += step;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * layout.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __LAYOUT_H__
+#define __LAYOUT_H__
+
+#include <stdint.h>
+
+#include "ws2811.h"
+
+/*
+ * Mapping of a row major framebuffer onto LED matrices.
+ *
+ * An installation is described as panels, each a grid of LEDs wired in rows or
+ * columns, optionally serpentine, mirrored, rotated and with unlit LEDs between
+ * lines, placed somewhere in the framebuffer and wired to a range of LEDs on a
+ * channel.  ws2811_layout_create() turns the description into runs of LEDs whose
+ * pixels are evenly spaced in the framebuffer, once, so that ws2811_layout_blit()
+ * is a copy per run rather than working out every LED's position each frame.
+ */
+
+#define WS2811_LAYOUT_SERPENTINE                 0x01         // Every other line runs backwards
+#define WS2811_LAYOUT_COLUMNS                    0x02         // Wired in columns instead of rows
+#define WS2811_LAYOUT_MIRROR_X                   0x04         // First LED on the right
+#define WS2811_LAYOUT_MIRROR_Y                   0x08         // First LED at the bottom
+
+typedef struct
+{
+    int channel;                                 //< Channel the panel is wired to
+    int first;                                   //< Index of its first LED on the channel
+    int x;                                       //< Framebuffer position of the top left corner,
+    int y;                                       //< after rotation
+    int width;                                   //< Size in LEDs, before rotation
+    int height;
+    int flags;                                   //< WS2811_LAYOUT_xxx
+    int rotation;                                //< Clockwise, 0, 90, 180 or 270 degrees
+    int gap;                                     //< Unlit LEDs between lines, kept black
+} ws2811_panel_t;
+
+typedef struct
+{
+    uint16_t channel;
+    uint16_t reserved;
+    uint32_t led;                                //< First LED on the channel
+    uint32_t count;                              //< Number of LEDs
+    int32_t src;                                 //< Framebuffer pixel of the first, -1 for black
+    int32_t step;                                //< Pixels from one LED's pixel to the next
+} ws2811_layout_run_t;
+
+typedef struct
+{
+    int width;                                   //< Framebuffer size in pixels
+    int height;
+    int runs;
+    ws2811_layout_run_t *run;
+} ws2811_layout_t;
+
+
+int ws2811_layout_create(ws2811_layout_t *layout, ws2811_t *ws2811, int width, int height,
+                         const ws2811_panel_t *panels, int count);
+void ws2811_layout_free(ws2811_layout_t *layout);
+void ws2811_layout_blit(ws2811_layout_t *layout, ws2811_t *ws2811, const ws2811_led_t *fb);
+
+
+#endif /* __LAYOUT_H__ */
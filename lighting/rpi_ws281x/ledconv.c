@@ -0,0 +1,276 @@
+/*
+ * ledconv.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Converts raw LED dumps to and from frame stream files, see stream.h.
+ *
+ * A raw dump is a sequence of frames, each frame the ws2811_led_t values of
+ * channel 0 followed by those of channel 1, in host byte order.
+ *
+ *     ledconv -c 1000[,count1] [-r fps] [-k interval] show.raw show.wsls
+ *     ledconv -d show.wsls show.raw
+ *     ledconv -i show.wsls
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ws2811.h"
+#include "stream.h"
+
+
+#define DEFAULT_FPS                              60
+#define DEFAULT_KEYFRAME_SECONDS                 1
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s -c count0[,count1] [-r fps] [-k interval] in.raw out.wsls\n"
+            "       %s -d in.wsls out.raw\n"
+            "       %s -i in.wsls\n"
+            "\n"
+            "  -c  LEDs per channel\n"
+            "  -r  frames per second to play at, default %d\n"
+            "  -k  frames between keyframes, default one second\n"
+            "  -d  decode a stream back to a raw dump\n"
+            "  -i  show stream information\n",
+            name, name, name, DEFAULT_FPS);
+}
+
+static int encode(const char *in, const char *out, const int *count, int fps, int interval)
+{
+    ws2811_stream_writer_t writer;
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    size_t total = count[0] + count[1];
+    ws2811_led_t *frame;
+    FILE *file;
+    int ret = 0;
+
+    file = fopen(in, "rb");
+    if (!file)
+    {
+        perror(in);
+        return -1;
+    }
+
+    frame = malloc(sizeof(ws2811_led_t) * (total + 1));
+    if (!frame)
+    {
+        fclose(file);
+        return -1;
+    }
+    leds[0] = frame;
+    leds[1] = frame + count[0];
+
+    if (ws2811_stream_create(&writer, out, count, fps, interval))
+    {
+        perror(out);
+        free(frame);
+        fclose(file);
+        return -1;
+    }
+
+    while (fread(frame, sizeof(ws2811_led_t), total, file) == total)
+    {
+        if (ws2811_stream_write(&writer, (const ws2811_led_t *const *)leds))
+        {
+            perror(out);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ws2811_stream_finish(&writer))
+    {
+        perror(out);
+        ret = -1;
+    }
+
+    free(frame);
+    fclose(file);
+
+    return ret;
+}
+
+static int decode(const char *in, const char *out)
+{
+    ws2811_stream_t stream;
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    ws2811_led_t *frame;
+    size_t total;
+    FILE *file;
+    int ret;
+
+    if (ws2811_stream_open(&stream, in))
+    {
+        fprintf(stderr, "%s: not a valid stream\n", in);
+        return -1;
+    }
+
+    total = stream.header->count[0] + stream.header->count[1];
+    frame = calloc(total + 1, sizeof(ws2811_led_t));
+    file = fopen(out, "wb");
+    if (!frame || !file)
+    {
+        perror(out);
+        free(frame);
+        ws2811_stream_close(&stream);
+        return -1;
+    }
+    leds[0] = frame;
+    leds[1] = frame + stream.header->count[0];
+
+    while ((ret = ws2811_stream_decode(&stream, leds)) == 1)
+    {
+        if (fwrite(frame, sizeof(ws2811_led_t), total, file) != total)
+        {
+            perror(out);
+            ret = -1;
+            break;
+        }
+    }
+
+    if (ret < 0)
+    {
+        fprintf(stderr, "%s: corrupt at frame %u\n", in, stream.frame);
+    }
+
+    if (fclose(file))
+    {
+        ret = -1;
+    }
+    free(frame);
+    ws2811_stream_close(&stream);
+
+    return ret;
+}
+
+static int info(const char *in)
+{
+    const ws2811_stream_header_t *header;
+    ws2811_stream_t stream;
+    uint64_t raw;
+
+    if (ws2811_stream_open(&stream, in))
+    {
+        fprintf(stderr, "%s: not a valid stream\n", in);
+        return -1;
+    }
+
+    header = stream.header;
+    raw = (uint64_t)header->frames * (header->count[0] + header->count[1]) * sizeof(ws2811_led_t);
+
+    printf("leds:      %u, %u\n", header->count[0], header->count[1]);
+    printf("frames:    %u at %u fps, %.1f seconds\n", header->frames, header->fps,
+           (double)header->frames / header->fps);
+    printf("keyframes: %u\n", header->keyframes);
+    printf("size:      %zu bytes, %.1f%% of raw\n", stream.size,
+           raw ? (100.0 * stream.size) / raw : 0.0);
+
+    ws2811_stream_close(&stream);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int count[RPI_PWM_CHANNELS] = { -1, 0 };
+    int fps = DEFAULT_FPS, interval = 0;
+    int mode = 'c';
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:r:k:di")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &count[0], &count[1]) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'r':
+                fps = atoi(optarg);
+                break;
+
+            case 'k':
+                interval = atoi(optarg);
+                break;
+
+            case 'd':
+            case 'i':
+                mode = opt;
+                break;
+
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if (mode == 'i')
+    {
+        if ((argc - optind) != 1)
+        {
+            usage(argv[0]);
+            return -1;
+        }
+
+        return info(argv[optind]);
+    }
+
+    if ((argc - optind) != 2)
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (mode == 'd')
+    {
+        return decode(argv[optind], argv[optind + 1]);
+    }
+
+    if ((count[0] < 0) || (count[1] < 0) || ((count[0] + count[1]) == 0) || (fps <= 0))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    return encode(argv[optind], argv[optind + 1], count, fps,
+                  interval ? interval : fps * DEFAULT_KEYFRAME_SECONDS);
+}
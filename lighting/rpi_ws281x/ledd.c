@@ -0,0 +1,630 @@
+/*
+ * ledd.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * LED daemon, so several processes can share the LEDs.
+ *
+ * ledd owns the hardware and publishes frame slots in shared memory (see client.h).
+ * Clients draw straight into their slot with ws2811_client_publish(), and at a fixed
+ * rate the daemon composites the newest frame of every slot, lowest priority first,
+ * and renders the result.  Slots of clients that exit or crash are freed within a
+ * second, and with -t the slots of clients that stop publishing stop being shown.
+ *
+ *     ledd -c 1000[,count1] [-g gpio0[,gpio1]] [-r fps] [-n slots] [-N name]
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "ws2811.h"
+#include "client.h"
+#include "compose.h"
+
+
+#define DMA                                      5
+#define FPS_DEFAULT                              60
+#define SLOTS_DEFAULT                            8
+#define SLOTS_MAX                                64
+#define MODE_DEFAULT                             0666         // Any local user may draw
+#define REAP_INTERVAL_NS                         1000000000ULL
+
+
+// What the daemon keeps about each slot.  Clients can write anything into the shared
+// memory, so the buffer shown and the layout only ever come from here.
+typedef struct
+{
+    uint32_t owner;                              // Owner as of the last frame
+    int shown;                                   // Holds a frame to composite
+    uint32_t front;                              // Buffer shown
+    uint32_t published;                          // Publish count as of the last frame
+    uint64_t published_ns;                       // When it last changed
+} slot_state_t;
+
+typedef struct
+{
+    ws2811_client_header_t *header;
+    size_t size;
+    int slots;
+    uint32_t count[RPI_PWM_CHANNELS];            // LEDs per channel
+    size_t slot_offset;                          // Slot layout, as set up by shm_setup()
+    size_t slot_size;
+    slot_state_t state[SLOTS_MAX];
+    uint64_t timeout_ns;                         // Stop showing idle slots, 0 for never
+    uint64_t reap_ns;                            // Last check for dead clients
+    uint64_t stat_frames;
+    uint64_t stat_composites;
+    uint64_t stat_taken;
+} daemon_t;
+
+
+ws2811_t ledstring =
+{
+    .freq = WS2811_TARGET_FREQ,
+    .dmanum = DMA,
+    .channel =
+    {
+        [0] =
+        {
+            .gpionum = 18,
+            .brightness = 255,
+        },
+        [1] =
+        {
+            .gpionum = 0,
+            .brightness = 255,
+        },
+    },
+};
+
+static volatile sig_atomic_t running = 1;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void stop_handler(int signum)
+{
+    running = 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s -c count0[,count1] [-g gpio0[,gpio1]] [-r fps] [-n slots] [-N name]\n"
+            "          [-m mode] [-t ms] [-v]\n"
+            "\n"
+            "  -c  LEDs per channel\n"
+            "  -g  GPIO pin per channel, default 18\n"
+            "  -r  frames per second, default %d\n"
+            "  -n  client slots, default %d, at most %d\n"
+            "  -N  shared memory name, default %s\n"
+            "  -m  shared memory permissions, default %o\n"
+            "  -t  stop showing slots not published to for this many ms\n"
+            "  -v  print statistics every second\n",
+            name, FPS_DEFAULT, SLOTS_DEFAULT, SLOTS_MAX, WS2811_CLIENT_NAME, MODE_DEFAULT);
+}
+
+/**
+ * Find a slot, from the daemon's own copy of the layout rather than the header that
+ * clients could overwrite.
+ *
+ * @param    daemon  Daemon state.
+ * @param    index   Slot number, below daemon->slots.
+ *
+ * @returns  Pointer to the slot.
+ */
+static ws2811_client_slot_t *daemon_slot(daemon_t *daemon, int index)
+{
+    return (ws2811_client_slot_t *)((uint8_t *)daemon->header + daemon->slot_offset +
+                                    (index * daemon->slot_size));
+}
+
+/**
+ * Create the shared memory object with all slots free.  A stale one left behind by
+ * an earlier daemon is replaced, its clients have to reconnect.
+ *
+ * @param    daemon  Daemon state.
+ * @param    name    Shared memory object name.
+ * @param    mode    Permissions.
+ * @param    fps     Rate the frames are rendered at.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int shm_setup(daemon_t *daemon, const char *name, mode_t mode, int fps)
+{
+    ws2811_client_header_t *header;
+    int count[RPI_PWM_CHANNELS] = { ledstring.channel[0].count, ledstring.channel[1].count };
+    size_t size = ws2811_client_size(daemon->slots, count);
+    void *map;
+    int fd, i;
+
+    shm_unlink(name);
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, mode);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    // Not subject to the umask
+    if (fchmod(fd, mode) || ftruncate(fd, size))
+    {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        shm_unlink(name);
+        return -1;
+    }
+
+    header = map;
+    header->version = WS2811_CLIENT_VERSION;
+    header->channels = RPI_PWM_CHANNELS;
+    header->count[0] = count[0];
+    header->count[1] = count[1];
+    header->slots = daemon->slots;
+    daemon->header = header;
+    daemon->size = size;
+    daemon->count[0] = count[0];
+    daemon->count[1] = count[1];
+    daemon->slot_offset = ws2811_client_size(0, count);
+    daemon->slot_size = ws2811_client_size(1, count) - daemon->slot_offset;
+
+    header->slot_offset = daemon->slot_offset;
+    header->slot_size = daemon->slot_size;
+    header->fps = fps;
+    header->daemon_pid = getpid();
+
+    for (i = 0; i < daemon->slots; i++)
+    {
+        ws2811_client_slot_t *slot = daemon_slot(daemon, i);
+
+        slot->back = 0;
+        slot->middle = 1;
+        daemon->state[i].front = 2;
+    }
+
+    // Clients check the magic, so it goes in last
+    __atomic_store_n(&header->magic, WS2811_CLIENT_MAGIC, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * Free the slot of a client that went away, handing it the two buffers the daemon
+ * doesn't show, whatever the client left in the slot.
+ *
+ * @param    daemon  Daemon state.
+ * @param    index   Slot number.
+ *
+ * @returns  None
+ */
+static void slot_reset(daemon_t *daemon, int index)
+{
+    ws2811_client_slot_t *slot = daemon_slot(daemon, index);
+    uint32_t front = daemon->state[index].front;
+
+    slot->back = (front + 1) % WS2811_CLIENT_BUFFERS;
+    __atomic_store_n(&slot->middle, (front + 2) % WS2811_CLIENT_BUFFERS, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->owner, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Take the newest frame of every slot, and notice clients coming and going.
+ *
+ * @param    daemon  Daemon state.
+ *
+ * @returns  1 if what's shown changed, 0 otherwise.
+ */
+static int slots_update(daemon_t *daemon)
+{
+    uint64_t now = now_ns();
+    int reap = (now - daemon->reap_ns) >= REAP_INTERVAL_NS;
+    int changed = 0;
+    int i;
+
+    if (reap)
+    {
+        daemon->reap_ns = now;
+    }
+
+    for (i = 0; i < daemon->slots; i++)
+    {
+        ws2811_client_slot_t *slot = daemon_slot(daemon, i);
+        slot_state_t *state = &daemon->state[i];
+        uint32_t owner = __atomic_load_n(&slot->owner, __ATOMIC_ACQUIRE);
+
+        // A new client, or none, starts out showing nothing
+        if (owner != state->owner)
+        {
+            changed |= state->shown;
+            state->owner = owner;
+            state->shown = 0;
+            state->published = slot->published;
+            state->published_ns = now;
+        }
+
+        if (!owner)
+        {
+            continue;
+        }
+
+        // Crashed clients can't free their slot
+        if (reap && (kill(owner, 0) == -1) && (errno == ESRCH))
+        {
+            slot_reset(daemon, i);
+            changed |= state->shown;
+            state->owner = 0;
+            state->shown = 0;
+            continue;
+        }
+
+        if (__atomic_load_n(&slot->middle, __ATOMIC_ACQUIRE) & WS2811_CLIENT_FRESH)
+        {
+            uint32_t middle;
+
+            middle = __atomic_exchange_n(&slot->middle, state->front, __ATOMIC_ACQ_REL);
+            middle &= ~WS2811_CLIENT_FRESH;
+
+            // A client that scribbled over its slot isn't shown until it's fixed
+            if (middle < WS2811_CLIENT_BUFFERS)
+            {
+                state->front = middle;
+                state->shown = 1;
+                daemon->stat_taken++;
+            }
+            else
+            {
+                state->shown = 0;
+            }
+            changed = 1;
+        }
+
+        if (slot->published != state->published)
+        {
+            state->published = slot->published;
+            state->published_ns = now;
+        }
+        else if (daemon->timeout_ns && state->shown &&
+                 ((now - state->published_ns) >= daemon->timeout_ns))
+        {
+            state->shown = 0;
+            changed = 1;
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Composite a slot's frame on top of a channel's LEDs.
+ *
+ * @param    leds    LEDs composited so far.
+ * @param    src     The slot's LEDs for the channel.
+ * @param    count   Number of LEDs.
+ * @param    blend   WS2811_BLEND_xxx.
+ *
+ * @returns  None
+ */
+static void slot_blend(ws2811_led_t *leds, const ws2811_led_t *src, int count, uint32_t blend)
+{
+    int i;
+
+    switch (blend)
+    {
+        case WS2811_BLEND_OVER:
+            for (i = 0; i < count; i++)
+            {
+                if (src[i])
+                {
+                    leds[i] = src[i];
+                }
+            }
+            break;
+
+        case WS2811_BLEND_ADD:
+            ws2811_leds_add(leds, src, count);
+            break;
+
+        default:
+            memcpy(leds, src, count * sizeof(*leds));
+            break;
+    }
+}
+
+/**
+ * Composite the shown slots into the LEDs, lowest priority first.  Slots below the
+ * topmost opaque one are covered entirely and skipped.
+ *
+ * @param    daemon  Daemon state.
+ *
+ * @returns  None
+ */
+static void composite(daemon_t *daemon)
+{
+    uint32_t leds = daemon->count[0] + daemon->count[1];
+    const ws2811_led_t *buffer[SLOTS_MAX];
+    int32_t priority[SLOTS_MAX];
+    uint32_t blend[SLOTS_MAX];
+    int n = 0, first = 0;
+    int i, j, chan;
+
+    // Stable insertion sort by priority, slot number breaks ties.  Clients may change
+    // their settings at any time, so they're read once.
+    for (i = 0; i < daemon->slots; i++)
+    {
+        ws2811_client_slot_t *slot = daemon_slot(daemon, i);
+        int32_t slot_priority = slot->priority;
+
+        if (!daemon->state[i].shown)
+        {
+            continue;
+        }
+
+        for (j = n; (j > 0) && (priority[j - 1] > slot_priority); j--)
+        {
+            buffer[j] = buffer[j - 1];
+            priority[j] = priority[j - 1];
+            blend[j] = blend[j - 1];
+        }
+        buffer[j] = &slot->buffers[daemon->state[i].front * leds];
+        priority[j] = slot_priority;
+        blend[j] = slot->blend;
+        n++;
+    }
+
+    for (i = n - 1; i > 0; i--)
+    {
+        if (blend[i] == WS2811_BLEND_OPAQUE)
+        {
+            first = i;
+            break;
+        }
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ledstring.channel[chan];
+        uint32_t offset = chan ? daemon->count[0] : 0;
+
+        if (!channel->count)
+        {
+            continue;
+        }
+
+        if ((n == 0) || (blend[first] != WS2811_BLEND_OPAQUE))
+        {
+            memset(channel->leds, 0, channel->count * sizeof(ws2811_led_t));
+        }
+
+        for (i = first; i < n; i++)
+        {
+            slot_blend(channel->leds, &buffer[i][offset], channel->count, blend[i]);
+        }
+    }
+
+    daemon->stat_composites++;
+}
+
+static void stats_print(daemon_t *daemon, double seconds)
+{
+    ws2811_stats_t stats;
+    int clients = 0;
+    int i;
+
+    for (i = 0; i < daemon->slots; i++)
+    {
+        clients += daemon->state[i].owner != 0;
+    }
+
+    ws2811_get_stats(&ledstring, &stats);
+
+    printf("%d clients %6.1f frames/s %6.1f composites/s %8.1f slot frames/s "
+           "%llu deadlines missed\n",
+           clients, daemon->stat_frames / seconds, daemon->stat_composites / seconds,
+           daemon->stat_taken / seconds, (unsigned long long)stats.deadlines_missed);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sigaction sa =
+    {
+        .sa_handler = stop_handler,
+    };
+    static daemon_t daemon;
+    const char *name = WS2811_CLIENT_NAME;
+    mode_t mode = MODE_DEFAULT;
+    uint64_t stats_start;
+    int fps = FPS_DEFAULT;
+    int verbose = 0;
+    int ret = 0;
+    int opt;
+
+    daemon.slots = SLOTS_DEFAULT;
+
+    while ((opt = getopt(argc, argv, "c:g:r:n:N:m:t:v")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &ledstring.channel[0].count,
+                           &ledstring.channel[1].count) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'g':
+                if (sscanf(optarg, "%d,%d", &ledstring.channel[0].gpionum,
+                           &ledstring.channel[1].gpionum) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'r':
+                fps = atoi(optarg);
+                break;
+
+            case 'n':
+                daemon.slots = atoi(optarg);
+                break;
+
+            case 'N':
+                name = optarg;
+                break;
+
+            case 'm':
+                mode = strtol(optarg, NULL, 8);
+                break;
+
+            case 't':
+                daemon.timeout_ns = atoi(optarg) * 1000000ULL;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((ledstring.channel[0].count <= 0) || (ledstring.channel[1].count < 0) ||
+        (fps <= 0) || (daemon.slots <= 0) || (daemon.slots > SLOTS_MAX))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (ledstring.channel[1].count && !ledstring.channel[1].gpionum)
+    {
+        ledstring.channel[1].gpionum = 13;
+    }
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (ws2811_init(&ledstring))
+    {
+        return -1;
+    }
+
+    if (fps > ws2811_max_fps(&ledstring))
+    {
+        fprintf(stderr, "ledd: %d LEDs allow at most %d frames/s\n",
+                ledstring.channel[0].count + ledstring.channel[1].count,
+                ws2811_max_fps(&ledstring));
+        ws2811_fini(&ledstring);
+        return -1;
+    }
+
+    if (shm_setup(&daemon, name, mode, fps))
+    {
+        perror("ledd");
+        ws2811_fini(&ledstring);
+        return -1;
+    }
+
+    ws2811_set_fps(&ledstring, fps);
+    daemon.reap_ns = stats_start = now_ns();
+
+    while (running)
+    {
+        uint64_t now;
+
+        if (slots_update(&daemon))
+        {
+            composite(&daemon);
+        }
+
+        // Skipped by the driver if the LEDs didn't change
+        if (ws2811_present(&ledstring))
+        {
+            ret = -1;
+            break;
+        }
+
+        // Let clients waiting in ws2811_client_wait() draw the next one
+        __atomic_add_fetch(&daemon.header->frame, 1, __ATOMIC_RELEASE);
+        syscall(SYS_futex, &daemon.header->frame, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+        daemon.stat_frames++;
+
+        now = now_ns();
+        if (verbose && ((now - stats_start) >= 1000000000ULL))
+        {
+            stats_print(&daemon, (now - stats_start) / 1e9);
+            daemon.stat_frames = daemon.stat_composites = daemon.stat_taken = 0;
+            stats_start = now;
+        }
+    }
+
+    // Wake up waiting clients, they see the daemon is gone
+    daemon.header->daemon_pid = 0;
+    __atomic_add_fetch(&daemon.header->frame, 1, __ATOMIC_RELEASE);
+    syscall(SYS_futex, &daemon.header->frame, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    shm_unlink(name);
+    munmap(daemon.header, daemon.size);
+    ws2811_fini(&ledstring);
+
+    return ret;
+}
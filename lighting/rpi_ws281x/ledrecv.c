@@ -0,0 +1,785 @@
+/*
+ * ledrecv.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Receives E1.31 (sACN) and Art-Net universes and shows them on the LEDs.
+ *
+ * Universes map onto the LEDs in order, 170 LEDs each, channel 0 first and
+ * channel 1 starting on the next universe.  A frame is rendered once every
+ * universe came in, on a sync packet if the sender uses them, or when the rest
+ * of the frame doesn't show up within the timeout.  A frame is rendered as soon
+ * as it completes, before any further packets touch the LEDs.  Packets are taken
+ * in batches, and a frame is skipped if the rest of its batch carries all of a
+ * newer one, so a sender running faster than the LEDs doesn't build up a backlog.
+ *
+ *     ledrecv -c 1000[,count1] [-g gpio0[,gpio1]] [-u universe] [-a universe] [-e]
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ws2811.h"
+#include "netdmx.h"
+
+
+#define DMA                                      5
+#define RECV_BATCH                               64          // Packets per recvmmsg call
+#define RECV_BATCHES_MAX                         16          // Per wakeup, before rendering
+#define RECV_BUFFER_BYTES                        (4 * 1024 * 1024)
+#define FRAME_TIMEOUT_MS                         50          // Render a partial frame after this
+#define PACKET_MAX                               E131_PACKET_MAX
+
+
+typedef struct
+{
+    int fd[2];                                   // E1.31 and Art-Net sockets
+    int e131_universe;                           // First E1.31 universe
+    int artnet_universe;                         // First Art-Net port address
+    int universes[RPI_PWM_CHANNELS];             // Universes each channel takes
+    uint8_t *received;                           // Universes in the current frame
+    uint8_t *covered;                            // Universes in the rest of a batch
+    int pending;                                 // Number of them
+    uint64_t sync;                               // When the last sync packet came in
+    uint64_t frame_start;                        // When the first universe came in
+    uint64_t timeout_ns;                         // Partial frames and syncing expire after this
+    int ack;                                     // Tell senders when frames go out
+    struct sockaddr_in ack_addr;
+    uint8_t ack_sequence;
+    struct mmsghdr msgs[RECV_BATCH];
+    struct iovec iov[RECV_BATCH];
+    struct sockaddr_in addrs[RECV_BATCH];
+    uint8_t packets[RECV_BATCH][PACKET_MAX];
+    uint64_t stat_packets;
+    uint64_t stat_batches;
+    uint64_t stat_frames;
+    uint64_t stat_partial;
+    uint64_t stat_skipped;
+    uint64_t stat_ignored;
+} receiver_t;
+
+
+ws2811_t ledstring =
+{
+    .freq = WS2811_TARGET_FREQ,
+    .dmanum = DMA,
+    .channel =
+    {
+        [0] =
+        {
+            .gpionum = 18,
+            .brightness = 255,
+        },
+        [1] =
+        {
+            .gpionum = 0,
+            .brightness = 255,
+        },
+    },
+};
+
+static volatile sig_atomic_t running = 1;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint32_t be16(const uint8_t *p)
+{
+    return (p[0] << 8) | p[1];
+}
+
+static uint32_t be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+static void stop_handler(int signum)
+{
+    running = 0;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s -c count0[,count1] [-g gpio0[,gpio1]] [-u universe] [-a universe]\n"
+            "          [-t ms] [-e] [-v]\n"
+            "\n"
+            "  -c  LEDs per channel\n"
+            "  -g  GPIO pin per channel, default 18\n"
+            "  -u  first E1.31 universe, default 1\n"
+            "  -a  first Art-Net port address, default 0\n"
+            "  -t  frame timeout in ms, default %d\n"
+            "  -e  acknowledge frames to the sender, for ledsend\n"
+            "  -v  print statistics every second\n",
+            name, FRAME_TIMEOUT_MS);
+}
+
+/**
+ * Open a non-blocking UDP socket on a port, with room to queue packets up while a
+ * frame is being rendered.
+ *
+ * @param    port    UDP port.
+ *
+ * @returns  Socket, or -1 on error.
+ */
+static int socket_open(int port)
+{
+    struct sockaddr_in addr =
+    {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    int size = RECV_BUFFER_BYTES;
+    int on = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * Copy a universe's slots straight into the LED array it maps onto.
+ *
+ * @param    rx      Receiver.
+ * @param    index   Universe number, counted from the first one.
+ * @param    data    DMX slots, 3 per LED.
+ * @param    slots   Number of slots.
+ *
+ * @returns  None
+ */
+static void universe_apply(receiver_t *rx, int index, const uint8_t *data, int slots)
+{
+    ws2811_channel_t *channel;
+    int first, count, i;
+
+    if ((index < 0) || (index >= (rx->universes[0] + rx->universes[1])))
+    {
+        rx->stat_ignored++;
+        return;
+    }
+
+    if (index < rx->universes[0])
+    {
+        channel = &ledstring.channel[0];
+        first = index * DMX_UNIVERSE_LEDS;
+    }
+    else
+    {
+        channel = &ledstring.channel[1];
+        first = (index - rx->universes[0]) * DMX_UNIVERSE_LEDS;
+    }
+
+    count = slots / 3;
+    if (count > (channel->count - first))
+    {
+        count = channel->count - first;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+        channel->leds[first + i] = (data[0] << 16) | (data[1] << 8) | data[2];
+        data += 3;
+    }
+
+    if (!rx->received[index])
+    {
+        rx->received[index] = 1;
+        if (!rx->pending++)
+        {
+            rx->frame_start = now_ns();
+        }
+    }
+}
+
+/**
+ * Start on the next frame.
+ *
+ * @param    rx      Receiver.
+ *
+ * @returns  None
+ */
+static void frame_reset(receiver_t *rx)
+{
+    memset(rx->received, 0, rx->universes[0] + rx->universes[1]);
+    rx->pending = 0;
+}
+
+/**
+ * Send the frame that came in, and let the sender know if asked to.
+ *
+ * @param    rx      Receiver.
+ *
+ * @returns  0 on success, -1 on render error.
+ */
+static int frame_render(receiver_t *rx)
+{
+    if (rx->pending < (rx->universes[0] + rx->universes[1]))
+    {
+        rx->stat_partial++;
+    }
+
+    // Returns once the DMA has started on the frame
+    if (ws2811_render(&ledstring))
+    {
+        return -1;
+    }
+
+    rx->stat_frames++;
+    frame_reset(rx);
+
+    if (rx->ack && rx->ack_addr.sin_port)
+    {
+        uint8_t ack[NETDMX_ACK_SIZE];
+
+        memcpy(ack, NETDMX_ACK, NETDMX_ACK_SIZE - 1);
+        ack[NETDMX_ACK_SIZE - 1] = rx->ack_sequence;
+        sendto(rx->fd[0], ack, sizeof(ack), MSG_DONTWAIT, (struct sockaddr *)&rx->ack_addr,
+               sizeof(rx->ack_addr));
+    }
+
+    return 0;
+}
+
+/**
+ * Check whether a packet is an E1.31 universe sync packet.
+ *
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ *
+ * @returns  1 if it is, 0 otherwise.
+ */
+static int e131_sync(const uint8_t *p, int len)
+{
+    return (len >= E131_SYNC_SIZE) &&
+           !memcmp(&p[E131_ACN_ID_OFFSET], E131_ACN_ID, sizeof(E131_ACN_ID) - 1) &&
+           (be32(&p[E131_ROOT_VECTOR_OFFSET]) == E131_ROOT_VECTOR_EXTENDED) &&
+           (be32(&p[E131_FRAME_VECTOR_OFFSET]) == E131_FRAME_VECTOR_SYNC);
+}
+
+/**
+ * Find the universe an E1.31 data packet carries.
+ *
+ * @param    rx      Receiver.
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ *
+ * @returns  Universe number counted from the first one, negative if it isn't a data
+ *           packet to show or the universe comes before the first one.
+ */
+static int e131_universe(receiver_t *rx, const uint8_t *p, int len)
+{
+    if ((len < E131_DATA_OFFSET) ||
+        memcmp(&p[E131_ACN_ID_OFFSET], E131_ACN_ID, sizeof(E131_ACN_ID) - 1) ||
+        (be32(&p[E131_ROOT_VECTOR_OFFSET]) != E131_ROOT_VECTOR_DATA) ||
+        (be32(&p[E131_FRAME_VECTOR_OFFSET]) != E131_FRAME_VECTOR_DATA) ||
+        (p[E131_DMP_VECTOR_OFFSET] != E131_DMP_VECTOR) ||
+        (p[E131_OPTIONS_OFFSET] & E131_OPTION_PREVIEW) ||
+        p[E131_START_CODE_OFFSET])
+    {
+        return -1;
+    }
+
+    return (int)be16(&p[E131_UNIVERSE_OFFSET]) - rx->e131_universe;
+}
+
+/**
+ * Handle an E1.31 packet.
+ *
+ * @param    rx      Receiver.
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ * @param    from    Sender.
+ *
+ * @returns  1 if it's a sync packet, 0 otherwise.
+ */
+static int e131_packet(receiver_t *rx, const uint8_t *p, int len, const struct sockaddr_in *from)
+{
+    uint32_t count;
+    int index;
+
+    if (e131_sync(p, len))
+    {
+        rx->sync = now_ns();
+        return 1;
+    }
+
+    index = e131_universe(rx, p, len);
+    if (index < 0)
+    {
+        rx->stat_ignored++;
+        return 0;
+    }
+
+    count = be16(&p[E131_DMP_COUNT_OFFSET]);
+    count = count ? count - 1 : 0;
+    if (count > (len - E131_DATA_OFFSET))
+    {
+        count = len - E131_DATA_OFFSET;
+    }
+
+    rx->ack_addr = *from;
+    rx->ack_sequence = p[E131_SEQUENCE_OFFSET];
+
+    universe_apply(rx, index, &p[E131_DATA_OFFSET], count);
+
+    return 0;
+}
+
+/**
+ * Get an Art-Net packet's opcode.
+ *
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ *
+ * @returns  Opcode, or 0 if it isn't an Art-Net packet.
+ */
+static uint32_t artnet_opcode(const uint8_t *p, int len)
+{
+    if ((len < ARTNET_SYNC_SIZE) || memcmp(p, ARTNET_ID, sizeof(ARTNET_ID)))
+    {
+        return 0;
+    }
+
+    return p[ARTNET_OPCODE_OFFSET] | (p[ARTNET_OPCODE_OFFSET + 1] << 8);
+}
+
+/**
+ * Find the universe an Art-Net data packet carries.
+ *
+ * @param    rx      Receiver.
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ *
+ * @returns  Universe number counted from the first one, negative if it isn't a data
+ *           packet or the port address comes before the first one.
+ */
+static int artnet_universe(receiver_t *rx, const uint8_t *p, int len)
+{
+    if ((artnet_opcode(p, len) != ARTNET_OP_DMX) || (len < ARTNET_DATA_OFFSET))
+    {
+        return -1;
+    }
+
+    return ((p[ARTNET_UNIVERSE_OFFSET] | (p[ARTNET_UNIVERSE_OFFSET + 1] << 8)) & 0x7fff) -
+           rx->artnet_universe;
+}
+
+/**
+ * Handle an Art-Net packet.
+ *
+ * @param    rx      Receiver.
+ * @param    p       Packet.
+ * @param    len     Packet length.
+ * @param    from    Sender.
+ *
+ * @returns  1 if it's a sync packet, 0 otherwise.
+ */
+static int artnet_packet(receiver_t *rx, const uint8_t *p, int len, const struct sockaddr_in *from)
+{
+    uint32_t count;
+    int index;
+
+    if (artnet_opcode(p, len) == ARTNET_OP_SYNC)
+    {
+        rx->sync = now_ns();
+        return 1;
+    }
+
+    index = artnet_universe(rx, p, len);
+    if (index < 0)
+    {
+        rx->stat_ignored++;
+        return 0;
+    }
+
+    count = be16(&p[ARTNET_LENGTH_OFFSET]);
+    if (count > (len - ARTNET_DATA_OFFSET))
+    {
+        count = len - ARTNET_DATA_OFFSET;
+    }
+
+    rx->ack_addr = *from;
+    rx->ack_sequence = p[ARTNET_SEQUENCE_OFFSET];
+
+    universe_apply(rx, index, &p[ARTNET_DATA_OFFSET], count);
+
+    return 0;
+}
+
+/**
+ * Check whether the packets of a batch from a given one on carry every universe, so
+ * they overwrite all of a frame completed before them.
+ *
+ * @param    rx      Receiver.
+ * @param    artnet  1 for Art-Net packets, 0 for E1.31.
+ * @param    from    First packet to look at.
+ * @param    n       Packets in the batch.
+ *
+ * @returns  1 if they do, 0 otherwise.
+ */
+static int batch_covers(receiver_t *rx, int artnet, int from, int n)
+{
+    int total = rx->universes[0] + rx->universes[1];
+    int seen = 0;
+    int i;
+
+    if ((n - from) < total)
+    {
+        return 0;
+    }
+
+    memset(rx->covered, 0, total);
+    for (i = from; (i < n) && (seen < total); i++)
+    {
+        int index = artnet ? artnet_universe(rx, rx->packets[i], rx->msgs[i].msg_len) :
+                             e131_universe(rx, rx->packets[i], rx->msgs[i].msg_len);
+
+        if ((index >= 0) && (index < total) && !rx->covered[index])
+        {
+            rx->covered[index] = 1;
+            seen++;
+        }
+    }
+
+    return seen == total;
+}
+
+/**
+ * Drain a socket, a batch of packets per system call.  A frame is complete on a
+ * sync packet, or once every universe came in unless the sender synced within the
+ * timeout.  It's rendered right then, before the rest of the batch is applied,
+ * unless the rest of the batch overwrites it entirely anyway.
+ *
+ * @param    rx      Receiver.
+ * @param    artnet  1 for the Art-Net socket, 0 for E1.31.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int socket_drain(receiver_t *rx, int artnet)
+{
+    int total = rx->universes[0] + rx->universes[1];
+    int batches;
+
+    for (batches = 0; batches < RECV_BATCHES_MAX; batches++)
+    {
+        int n, i;
+
+        for (i = 0; i < RECV_BATCH; i++)
+        {
+            rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->addrs[i]);
+        }
+
+        n = recvmmsg(rx->fd[artnet], rx->msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+        {
+            return ((n < 0) && (errno != EAGAIN) && (errno != EINTR)) ? -1 : 0;
+        }
+
+        rx->stat_batches++;
+        rx->stat_packets += n;
+
+        for (i = 0; i < n; i++)
+        {
+            int sync;
+
+            if (artnet)
+            {
+                sync = artnet_packet(rx, rx->packets[i], rx->msgs[i].msg_len, &rx->addrs[i]);
+            }
+            else
+            {
+                sync = e131_packet(rx, rx->packets[i], rx->msgs[i].msg_len, &rx->addrs[i]);
+            }
+
+            if ((sync && rx->pending) ||
+                ((rx->pending == total) && ((now_ns() - rx->sync) >= rx->timeout_ns)))
+            {
+                if (batch_covers(rx, artnet, i + 1, n))
+                {
+                    rx->stat_skipped++;
+                    frame_reset(rx);
+                }
+                else if (frame_render(rx))
+                {
+                    return -1;
+                }
+            }
+        }
+
+        if (n < RECV_BATCH)
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Join the E1.31 multicast groups of the universes we listen to.  Unicast keeps
+ * working if this fails, so it only warns.
+ *
+ * @param    rx      Receiver.
+ *
+ * @returns  None
+ */
+static void multicast_join(receiver_t *rx)
+{
+    int i;
+
+    for (i = 0; i < (rx->universes[0] + rx->universes[1]); i++)
+    {
+        struct ip_mreq mreq =
+        {
+            .imr_multiaddr.s_addr = htonl(E131_MULTICAST(rx->e131_universe + i)),
+            .imr_interface.s_addr = htonl(INADDR_ANY),
+        };
+
+        if (setsockopt(rx->fd[0], IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)))
+        {
+            perror("ledrecv: multicast join");
+            return;
+        }
+    }
+}
+
+static void stats_print(receiver_t *rx, double seconds)
+{
+    printf("%8.1f packets/s %8.1f packets/batch %6.1f frames/s %llu partial %llu skipped "
+           "%llu ignored\n",
+           rx->stat_packets / seconds,
+           rx->stat_batches ? (double)rx->stat_packets / rx->stat_batches : 0.0,
+           rx->stat_frames / seconds, (unsigned long long)rx->stat_partial,
+           (unsigned long long)rx->stat_skipped, (unsigned long long)rx->stat_ignored);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sigaction sa =
+    {
+        .sa_handler = stop_handler,
+    };
+    static receiver_t rx;
+    uint64_t stats_start;
+    int verbose = 0;
+    int ret = 0;
+    int opt, i;
+
+    rx.e131_universe = 1;
+    rx.artnet_universe = 0;
+    rx.timeout_ns = FRAME_TIMEOUT_MS * 1000000ULL;
+
+    while ((opt = getopt(argc, argv, "c:g:u:a:t:ev")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &ledstring.channel[0].count,
+                           &ledstring.channel[1].count) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'g':
+                if (sscanf(optarg, "%d,%d", &ledstring.channel[0].gpionum,
+                           &ledstring.channel[1].gpionum) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'u':
+                rx.e131_universe = atoi(optarg);
+                break;
+
+            case 'a':
+                rx.artnet_universe = atoi(optarg);
+                break;
+
+            case 't':
+                rx.timeout_ns = atoi(optarg) * 1000000ULL;
+                break;
+
+            case 'e':
+                rx.ack = 1;
+                break;
+
+            case 'v':
+                verbose = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((ledstring.channel[0].count <= 0) || (ledstring.channel[1].count < 0))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    if (ledstring.channel[1].count && !ledstring.channel[1].gpionum)
+    {
+        ledstring.channel[1].gpionum = 13;
+    }
+
+    for (i = 0; i < RPI_PWM_CHANNELS; i++)
+    {
+        rx.universes[i] = (ledstring.channel[i].count + DMX_UNIVERSE_LEDS - 1) / DMX_UNIVERSE_LEDS;
+    }
+
+    rx.received = calloc(rx.universes[0] + rx.universes[1], 1);
+    rx.covered = calloc(rx.universes[0] + rx.universes[1], 1);
+    for (i = 0; i < RECV_BATCH; i++)
+    {
+        rx.iov[i].iov_base = rx.packets[i];
+        rx.iov[i].iov_len = PACKET_MAX;
+        rx.msgs[i].msg_hdr.msg_iov = &rx.iov[i];
+        rx.msgs[i].msg_hdr.msg_iovlen = 1;
+        rx.msgs[i].msg_hdr.msg_name = &rx.addrs[i];
+    }
+
+    rx.fd[0] = socket_open(E131_PORT);
+    rx.fd[1] = socket_open(ARTNET_PORT);
+    if (!rx.received || !rx.covered || (rx.fd[0] == -1) || (rx.fd[1] == -1))
+    {
+        perror("ledrecv");
+        return -1;
+    }
+    multicast_join(&rx);
+
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    if (ws2811_init(&ledstring))
+    {
+        return -1;
+    }
+
+    stats_start = now_ns();
+
+    while (running)
+    {
+        struct pollfd fds[2] =
+        {
+            { .fd = rx.fd[0], .events = POLLIN },
+            { .fd = rx.fd[1], .events = POLLIN },
+        };
+        uint64_t now = now_ns();
+        int wait = verbose ? 1000 : -1;
+
+        if (rx.pending)
+        {
+            uint64_t due = rx.frame_start + rx.timeout_ns;
+
+            wait = (due > now) ? (((due - now) / 1000000) + 1) : 0;
+        }
+
+        if ((poll(fds, 2, wait) < 0) && (errno != EINTR))
+        {
+            ret = -1;
+            break;
+        }
+
+        for (i = 0; i < 2; i++)
+        {
+            if ((fds[i].revents & POLLIN) && socket_drain(&rx, i))
+            {
+                ret = -1;
+                running = 0;
+            }
+        }
+
+        // Show what we have if the rest of the frame isn't coming
+        if (rx.pending && ((now_ns() - rx.frame_start) >= rx.timeout_ns))
+        {
+            if (frame_render(&rx))
+            {
+                ret = -1;
+                break;
+            }
+        }
+
+        now = now_ns();
+        if (verbose && ((now - stats_start) >= 1000000000ULL))
+        {
+            stats_print(&rx, (now - stats_start) / 1e9);
+            rx.stat_packets = rx.stat_batches = rx.stat_frames = 0;
+            stats_start = now;
+        }
+    }
+
+    ws2811_fini(&ledstring);
+    close(rx.fd[0]);
+    close(rx.fd[1]);
+    free(rx.received);
+    free(rx.covered);
+
+    return ret;
+}
@@ -0,0 +1,519 @@
+/*
+ * ledsend.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Load generator for ledrecv.  Sends frames of E1.31 or Art-Net universes as fast
+ * as possible or at a given rate, and reports the packet rate and, with ledrecv -e,
+ * the latency from sending a frame to the DMA starting on it.
+ *
+ *     ledsend -c 1000[,count1] [-h host] [-r fps] [-t seconds] [-s] [-A]
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ws2811.h"
+#include "netdmx.h"
+
+
+#define DEFAULT_SECONDS                          5
+#define SEND_BATCH                               64          // Packets per sendmmsg call
+#define SEQUENCES                                256
+
+
+typedef struct
+{
+    int fd;
+    struct sockaddr_in addr;
+    int artnet;
+    int sync;
+    int universe;                                // First universe or port address
+    int universes[RPI_PWM_CHANNELS];
+    int count[RPI_PWM_CHANNELS];
+    uint8_t (*packets)[E131_PACKET_MAX];
+    int sizes[SEND_BATCH];
+    uint64_t sent_ns[SEQUENCES];                 // When each sequence number went out
+    uint64_t *latency;                           // Of every acknowledged frame
+    uint64_t latencies;
+    uint64_t latency_size;
+    uint64_t packets_sent;
+    uint64_t frames_sent;
+} sender_t;
+
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static void put16(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 8;
+    p[1] = value;
+}
+
+static void put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s -c count0[,count1] [-h host] [-u universe] [-r fps] [-t seconds] [-s] [-A]\n"
+            "\n"
+            "  -c  LEDs per channel, as given to ledrecv\n"
+            "  -h  receiver address, default 127.0.0.1\n"
+            "  -u  first universe, default 1 for E1.31 and 0 for Art-Net\n"
+            "  -r  frames per second, default as fast as possible\n"
+            "  -t  seconds to run, default %d\n"
+            "  -s  send a sync packet after each frame\n"
+            "  -A  send Art-Net instead of E1.31\n",
+            name, DEFAULT_SECONDS);
+}
+
+/**
+ * Build an E1.31 data packet.
+ *
+ * @returns  Packet length.
+ */
+static int e131_data(uint8_t *p, int universe, uint8_t sequence, int sync, const uint8_t *data,
+                     int slots)
+{
+    int len = E131_DATA_OFFSET + slots;
+
+    memset(p, 0, E131_DATA_OFFSET);
+
+    // Root layer
+    put16(&p[0], 0x0010);
+    memcpy(&p[E131_ACN_ID_OFFSET], E131_ACN_ID, sizeof(E131_ACN_ID) - 1);
+    put16(&p[16], 0x7000 | (len - 16));
+    put32(&p[E131_ROOT_VECTOR_OFFSET], E131_ROOT_VECTOR_DATA);
+    memcpy(&p[22], "ledsend", 7);                // CID
+
+    // Framing layer
+    put16(&p[38], 0x7000 | (len - 38));
+    put32(&p[E131_FRAME_VECTOR_OFFSET], E131_FRAME_VECTOR_DATA);
+    strcpy((char *)&p[E131_SOURCE_OFFSET], "ledsend");
+    p[E131_PRIORITY_OFFSET] = 100;
+    put16(&p[E131_SYNC_ADDRESS_OFFSET], sync ? universe : 0);
+    p[E131_SEQUENCE_OFFSET] = sequence;
+    put16(&p[E131_UNIVERSE_OFFSET], universe);
+
+    // DMP layer
+    put16(&p[115], 0x7000 | (len - 115));
+    p[E131_DMP_VECTOR_OFFSET] = E131_DMP_VECTOR;
+    p[E131_DMP_TYPE_OFFSET] = E131_DMP_TYPE;
+    put16(&p[E131_DMP_INCREMENT_OFFSET], 1);
+    put16(&p[E131_DMP_COUNT_OFFSET], slots + 1);
+    memcpy(&p[E131_DATA_OFFSET], data, slots);
+
+    return len;
+}
+
+/**
+ * Build an E1.31 universe synchronization packet.
+ *
+ * @returns  Packet length.
+ */
+static int e131_sync(uint8_t *p, int universe, uint8_t sequence)
+{
+    memset(p, 0, E131_SYNC_SIZE);
+
+    put16(&p[0], 0x0010);
+    memcpy(&p[E131_ACN_ID_OFFSET], E131_ACN_ID, sizeof(E131_ACN_ID) - 1);
+    put16(&p[16], 0x7000 | (E131_SYNC_SIZE - 16));
+    put32(&p[E131_ROOT_VECTOR_OFFSET], E131_ROOT_VECTOR_EXTENDED);
+    memcpy(&p[22], "ledsend", 7);
+
+    put16(&p[38], 0x7000 | (E131_SYNC_SIZE - 38));
+    put32(&p[E131_FRAME_VECTOR_OFFSET], E131_FRAME_VECTOR_SYNC);
+    p[E131_SYNC_SEQUENCE_OFFSET] = sequence;
+    put16(&p[E131_SYNC_UNIVERSE_OFFSET], universe);
+
+    return E131_SYNC_SIZE;
+}
+
+/**
+ * Build an Art-Net ArtDmx packet.
+ *
+ * @returns  Packet length.
+ */
+static int artnet_dmx(uint8_t *p, int universe, uint8_t sequence, const uint8_t *data, int slots)
+{
+    // Data length has to be even
+    slots += slots & 1;
+
+    memcpy(p, ARTNET_ID, sizeof(ARTNET_ID));
+    p[ARTNET_OPCODE_OFFSET] = ARTNET_OP_DMX & 0xff;
+    p[ARTNET_OPCODE_OFFSET + 1] = ARTNET_OP_DMX >> 8;
+    put16(&p[ARTNET_VERSION_OFFSET], ARTNET_VERSION);
+    p[ARTNET_SEQUENCE_OFFSET] = sequence;
+    p[13] = 0;
+    p[ARTNET_UNIVERSE_OFFSET] = universe & 0xff;
+    p[ARTNET_UNIVERSE_OFFSET + 1] = (universe >> 8) & 0x7f;
+    put16(&p[ARTNET_LENGTH_OFFSET], slots);
+    memcpy(&p[ARTNET_DATA_OFFSET], data, slots);
+
+    return ARTNET_DATA_OFFSET + slots;
+}
+
+/**
+ * Build an Art-Net ArtSync packet.
+ *
+ * @returns  Packet length.
+ */
+static int artnet_sync(uint8_t *p)
+{
+    memset(p, 0, ARTNET_SYNC_SIZE);
+    memcpy(p, ARTNET_ID, sizeof(ARTNET_ID));
+    p[ARTNET_OPCODE_OFFSET] = ARTNET_OP_SYNC & 0xff;
+    p[ARTNET_OPCODE_OFFSET + 1] = ARTNET_OP_SYNC >> 8;
+    put16(&p[ARTNET_VERSION_OFFSET], ARTNET_VERSION);
+
+    return ARTNET_SYNC_SIZE;
+}
+
+/**
+ * Send a batch of packets.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int batch_send(sender_t *tx, int n)
+{
+    struct mmsghdr msgs[SEND_BATCH];
+    struct iovec iov[SEND_BATCH];
+    int i, sent = 0;
+
+    for (i = 0; i < n; i++)
+    {
+        iov[i].iov_base = tx->packets[i];
+        iov[i].iov_len = tx->sizes[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &tx->addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(tx->addr);
+    }
+
+    while (sent < n)
+    {
+        int ret = sendmmsg(tx->fd, &msgs[sent], n - sent, 0);
+
+        if (ret < 0)
+        {
+            if ((errno == EINTR) || (errno == ENOBUFS))
+            {
+                continue;
+            }
+            return -1;
+        }
+
+        sent += ret;
+    }
+
+    tx->packets_sent += n;
+
+    return 0;
+}
+
+/**
+ * Send one frame of all universes, with a color pattern that changes every frame so
+ * the receiver never skips it.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+static int frame_send(sender_t *tx, uint8_t sequence)
+{
+    uint8_t data[DMX_SLOTS];
+    int chan, u, n = 0, index = 0;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        for (u = 0; u < tx->universes[chan]; u++, index++)
+        {
+            int leds = tx->count[chan] - (u * DMX_UNIVERSE_LEDS);
+            int i;
+
+            if (leds > DMX_UNIVERSE_LEDS)
+            {
+                leds = DMX_UNIVERSE_LEDS;
+            }
+
+            for (i = 0; i < (leds * 3); i++)
+            {
+                data[i] = sequence + index + i;
+            }
+
+            if (tx->artnet)
+            {
+                tx->sizes[n] = artnet_dmx(tx->packets[n], tx->universe + index, sequence, data,
+                                          leds * 3);
+            }
+            else
+            {
+                tx->sizes[n] = e131_data(tx->packets[n], tx->universe + index, sequence, tx->sync,
+                                         data, leds * 3);
+            }
+
+            if ((++n == SEND_BATCH) && batch_send(tx, n))
+            {
+                return -1;
+            }
+            n %= SEND_BATCH;
+        }
+    }
+
+    if (tx->sync)
+    {
+        tx->sizes[n] = tx->artnet ? artnet_sync(tx->packets[n]) :
+                                    e131_sync(tx->packets[n], tx->universe, sequence);
+        n++;
+    }
+
+    if (n && batch_send(tx, n))
+    {
+        return -1;
+    }
+
+    tx->sent_ns[sequence] = now_ns();
+    tx->frames_sent++;
+
+    return 0;
+}
+
+/**
+ * Read the acknowledgements that came back so far.
+ *
+ * @returns  None
+ */
+static void acks_read(sender_t *tx)
+{
+    uint8_t ack[NETDMX_ACK_SIZE];
+
+    while (recv(tx->fd, ack, sizeof(ack), MSG_DONTWAIT) == sizeof(ack))
+    {
+        uint64_t sent = tx->sent_ns[ack[NETDMX_ACK_SIZE - 1]];
+
+        if (memcmp(ack, NETDMX_ACK, NETDMX_ACK_SIZE - 1) || !sent)
+        {
+            continue;
+        }
+
+        if (tx->latencies == tx->latency_size)
+        {
+            uint64_t *latency;
+
+            latency = realloc(tx->latency, sizeof(*latency) * (tx->latency_size + 4096));
+            if (!latency)
+            {
+                return;
+            }
+            tx->latency = latency;
+            tx->latency_size += 4096;
+        }
+
+        tx->latency[tx->latencies++] = now_ns() - sent;
+    }
+}
+
+static int latency_compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[])
+{
+    static sender_t tx;
+    const char *host = "127.0.0.1";
+    int seconds = DEFAULT_SECONDS, fps = 0, universe = -1;
+    uint64_t start, next, period, elapsed;
+    uint8_t sequence = 0;
+    int opt, chan;
+
+    while ((opt = getopt(argc, argv, "c:h:u:r:t:sA")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (sscanf(optarg, "%d,%d", &tx.count[0], &tx.count[1]) < 1)
+                {
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+
+            case 'h':
+                host = optarg;
+                break;
+
+            case 'u':
+                universe = atoi(optarg);
+                break;
+
+            case 'r':
+                fps = atoi(optarg);
+                break;
+
+            case 't':
+                seconds = atoi(optarg);
+                break;
+
+            case 's':
+                tx.sync = 1;
+                break;
+
+            case 'A':
+                tx.artnet = 1;
+                break;
+
+            default:
+                usage(argv[0]);
+                return -1;
+        }
+    }
+
+    if ((tx.count[0] <= 0) || (tx.count[1] < 0) || (seconds <= 0) || (fps < 0))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    tx.universe = (universe >= 0) ? universe : !tx.artnet;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        tx.universes[chan] = (tx.count[chan] + DMX_UNIVERSE_LEDS - 1) / DMX_UNIVERSE_LEDS;
+    }
+
+    tx.addr.sin_family = AF_INET;
+    tx.addr.sin_port = htons(tx.artnet ? ARTNET_PORT : E131_PORT);
+    if (!inet_aton(host, &tx.addr.sin_addr))
+    {
+        fprintf(stderr, "%s: bad address\n", host);
+        return -1;
+    }
+
+    tx.packets = malloc(sizeof(*tx.packets) * SEND_BATCH);
+    tx.fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (!tx.packets || (tx.fd == -1))
+    {
+        perror("ledsend");
+        return -1;
+    }
+
+    period = fps ? (1000000000ULL / fps) : 0;
+    start = next = now_ns();
+
+    do
+    {
+        if (frame_send(&tx, sequence++))
+        {
+            perror("ledsend");
+            return -1;
+        }
+
+        acks_read(&tx);
+
+        // Wait for the next frame, picking up acknowledgements as they come in
+        next += period;
+        while (period && (now_ns() < next))
+        {
+            struct pollfd fds = { .fd = tx.fd, .events = POLLIN };
+            uint64_t left = next - now_ns();
+            struct timespec ts =
+            {
+                .tv_sec = left / 1000000000ULL,
+                .tv_nsec = left % 1000000000ULL,
+            };
+
+            if ((left < period) && (ppoll(&fds, 1, &ts, NULL) > 0))
+            {
+                acks_read(&tx);
+            }
+        }
+
+        elapsed = now_ns() - start;
+    } while (elapsed < (seconds * 1000000000ULL));
+
+    // Give the last acknowledgements a moment to come back
+    usleep(100000);
+    acks_read(&tx);
+
+    printf("%llu frames, %llu packets in %.2fs: %.1f frames/s, %.1f packets/s\n",
+           (unsigned long long)tx.frames_sent, (unsigned long long)tx.packets_sent,
+           elapsed / 1e9, tx.frames_sent * 1e9 / elapsed, tx.packets_sent * 1e9 / elapsed);
+
+    if (tx.latencies)
+    {
+        uint64_t sum = 0, i;
+
+        qsort(tx.latency, tx.latencies, sizeof(*tx.latency), latency_compare);
+        for (i = 0; i < tx.latencies; i++)
+        {
+            sum += tx.latency[i];
+        }
+
+        printf("%llu frames shown, latency to DMA start: avg %.1fus p50 %.1fus p99 %.1fus "
+               "max %.1fus\n", (unsigned long long)tx.latencies, sum / 1e3 / tx.latencies,
+               tx.latency[tx.latencies / 2] / 1e3, tx.latency[(tx.latencies * 99) / 100] / 1e3,
+               tx.latency[tx.latencies - 1] / 1e3);
+    }
+    else
+    {
+        printf("no frames acknowledged, run ledrecv with -e to measure latency\n");
+    }
+
+    close(tx.fd);
+    free(tx.packets);
+    free(tx.latency);
+
+    return 0;
+}
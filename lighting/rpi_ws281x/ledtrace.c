@@ -0,0 +1,194 @@
+/*
+ * ledtrace.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+/*
+ * Converts a trace saved by ws2811_trace_save() into Chrome trace JSON, to load into
+ * chrome://tracing or https://ui.perfetto.dev.
+ *
+ *     ledtrace render.wstrace > render.json
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s trace [out.json]\n", name);
+}
+
+/**
+ * Write a string as a JSON string literal.
+ *
+ * @param    out     Output file.
+ * @param    s       String.
+ *
+ * @returns  None
+ */
+static void json_string(FILE *out, const char *s)
+{
+    fputc('"', out);
+    for (; *s; s++)
+    {
+        if ((*s == '"') || (*s == '\\'))
+        {
+            fprintf(out, "\\%c", *s);
+        }
+        else if ((unsigned char)*s < 0x20)
+        {
+            fprintf(out, "\\u%04x", *s);
+        }
+        else
+        {
+            fputc(*s, out);
+        }
+    }
+    fputc('"', out);
+}
+
+int main(int argc, char *argv[])
+{
+    ws2811_trace_header_t header;
+    ws2811_trace_event_t event;
+    char **names = NULL;
+    uint64_t origin = UINT64_MAX;
+    long events_offset;
+    FILE *in, *out = stdout;
+    uint32_t i;
+    int ret = -1;
+
+    if ((argc < 2) || (argc > 3))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+
+    in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror(argv[1]);
+        return -1;
+    }
+
+    if ((fread(&header, sizeof(header), 1, in) != 1) ||
+        (header.magic != WS2811_TRACE_MAGIC) ||
+        (header.version != WS2811_TRACE_VERSION))
+    {
+        fprintf(stderr, "%s: not a trace file\n", argv[1]);
+        goto out;
+    }
+
+    names = calloc(header.names ? header.names : 1, sizeof(*names));
+    if (!names)
+    {
+        goto out;
+    }
+
+    for (i = 0; i < header.names; i++)
+    {
+        uint8_t len;
+
+        names[i] = calloc(1, 256);
+        if (!names[i] || (fread(&len, 1, 1, in) != 1) ||
+            (len && (fread(names[i], len, 1, in) != 1)))
+        {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            goto out;
+        }
+    }
+
+    // Times start at the first event, events are only in order per thread
+    events_offset = ftell(in);
+    for (i = 0; i < header.events; i++)
+    {
+        if (fread(&event, sizeof(event), 1, in) != 1)
+        {
+            fprintf(stderr, "%s: truncated\n", argv[1]);
+            goto out;
+        }
+        if (event.ts_ns < origin)
+        {
+            origin = event.ts_ns;
+        }
+    }
+    fseek(in, events_offset, SEEK_SET);
+
+    if ((argc == 3) && !(out = fopen(argv[2], "w")))
+    {
+        perror(argv[2]);
+        out = NULL;
+        goto out;
+    }
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (i = 0; i < header.events; i++)
+    {
+        uint64_t ts;
+
+        if (fread(&event, sizeof(event), 1, in) != 1)
+        {
+            goto out;
+        }
+
+        ts = event.ts_ns - origin;
+
+        fprintf(out, "%s{\"name\":", i ? ",\n" : "");
+        json_string(out, (event.name < header.names) ? names[event.name] : "?");
+        fprintf(out, ",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":%u,\"tid\":%u%s}",
+                event.phase, (unsigned long long)(ts / 1000), (unsigned)(ts % 1000),
+                header.pid, event.tid,
+                (event.phase == WS2811_TRACE_INSTANT) ? ",\"s\":\"t\"" : "");
+    }
+    fprintf(out, "\n]}\n");
+
+    ret = 0;
+
+out:
+    if (names)
+    {
+        for (i = 0; i < header.names; i++)
+        {
+            free(names[i]);
+        }
+        free(names);
+    }
+    if (out && (out != stdout))
+    {
+        fclose(out);
+    }
+    fclose(in);
+
+    return ret;
+}
@@ -57,6 +57,8 @@
 #define HEIGHT                                   8
 #define LED_COUNT                                (WIDTH * HEIGHT)
 
+#define FPS                                      15
+
 
 ws2811_t ledstring =
 {
@@ -166,20 +168,23 @@ int main(int argc, char *argv[])
         return -1;
     }
 
+    if (ws2811_set_fps(&ledstring, FPS))
+    {
+        ws2811_fini(&ledstring);
+        return -1;
+    }
+
     while (1)
     {
         matrix_raise();
         matrix_bottom();
         matrix_render();
 
-        if (ws2811_render(&ledstring))
+        if (ws2811_present(&ledstring))
         {
             ret = -1;
             break;
         }
-
-        // 15 frames /sec
-        usleep(1000000 / 15);
     }
 
     ws2811_fini(&ledstring);
@@ -0,0 +1,93 @@
+/*
+ * netdmx.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __NETDMX_H__
+#define __NETDMX_H__
+
+/*
+ * DMX over UDP, the parts of E1.31 (sACN) and Art-Net that ledrecv and ledsend use.
+ * Each universe carries 512 slots, 170 LEDs at 3 slots each.
+ */
+
+#define DMX_SLOTS                                512
+#define DMX_UNIVERSE_LEDS                        (DMX_SLOTS / 3)
+
+// E1.31, all values big endian
+#define E131_PORT                                5568
+#define E131_ACN_ID                              "ASC-E1.17\0\0\0"
+#define E131_ACN_ID_OFFSET                       4
+#define E131_ROOT_VECTOR_OFFSET                  18
+#define E131_ROOT_VECTOR_DATA                    0x00000004
+#define E131_ROOT_VECTOR_EXTENDED                0x00000008
+#define E131_FRAME_VECTOR_OFFSET                 40
+#define E131_FRAME_VECTOR_DATA                   0x00000002
+#define E131_FRAME_VECTOR_SYNC                   0x00000001   // In an extended root
+#define E131_SOURCE_OFFSET                       44           // 64 byte source name
+#define E131_PRIORITY_OFFSET                     108
+#define E131_SYNC_ADDRESS_OFFSET                 109          // Universe syncing this one, or 0
+#define E131_SEQUENCE_OFFSET                     111
+#define E131_OPTIONS_OFFSET                      112
+#define E131_OPTION_PREVIEW                      0x80
+#define E131_UNIVERSE_OFFSET                     113
+#define E131_DMP_VECTOR_OFFSET                   117
+#define E131_DMP_VECTOR                          0x02
+#define E131_DMP_TYPE_OFFSET                     118
+#define E131_DMP_TYPE                            0xa1
+#define E131_DMP_INCREMENT_OFFSET                121
+#define E131_DMP_COUNT_OFFSET                    123          // Start code plus slots
+#define E131_START_CODE_OFFSET                   125
+#define E131_DATA_OFFSET                         126
+#define E131_PACKET_MAX                          (E131_DATA_OFFSET + DMX_SLOTS)
+#define E131_SYNC_SEQUENCE_OFFSET                44
+#define E131_SYNC_UNIVERSE_OFFSET                45
+#define E131_SYNC_SIZE                           49
+#define E131_MULTICAST(universe)                 (0xefff0000 | ((universe) & 0xffff))
+
+// Art-Net, opcodes little endian, everything else big endian
+#define ARTNET_PORT                              6454
+#define ARTNET_ID                                "Art-Net\0"
+#define ARTNET_OPCODE_OFFSET                     8
+#define ARTNET_OP_DMX                            0x5000
+#define ARTNET_OP_SYNC                           0x5200
+#define ARTNET_VERSION_OFFSET                    10
+#define ARTNET_VERSION                           14
+#define ARTNET_SEQUENCE_OFFSET                   12
+#define ARTNET_UNIVERSE_OFFSET                   14           // 15 bit port address, little endian
+#define ARTNET_LENGTH_OFFSET                     16
+#define ARTNET_DATA_OFFSET                       18
+#define ARTNET_PACKET_MAX                        (ARTNET_DATA_OFFSET + DMX_SLOTS)
+#define ARTNET_SYNC_SIZE                         14
+
+// Sent back by ledrecv -e when a frame starts going out, followed by its sequence number
+#define NETDMX_ACK                               "WSACK"
+#define NETDMX_ACK_SIZE                          6
+
+
+#endif /* __NETDMX_H__ */
@@ -26,7 +26,7 @@ class _LED_Data(object):
 		# Handle if a slice of positions are passed in by grabbing all the values
 		# and returning them in a list.
 		if isinstance(pos, slice):
-			return [ws.ws2811_led_get(self.channel, n) for n in range(pos.indices(self.size))]
+			return [ws.ws2811_led_get(self.channel, n) for n in range(*pos.indices(self.size))]
 		# Else assume the passed in value is a number to the position.
 		else:
 			return ws.ws2811_led_get(self.channel, pos)
@@ -36,26 +36,32 @@ class _LED_Data(object):
 		positions.
 		"""
 		# Handle if a slice of positions are passed in by setting the appropriate
-		# LED data values to the provided values.
+		# LED data values to the provided values, all in one call if contiguous.
 		if isinstance(pos, slice):
-			index = 0
-			for n in range(pos.indices(self.size)):
-				ws.ws2811_led_set(self.channel, n, value[index])
-				index += 1
+			start, stop, step = pos.indices(self.size)
+			if step == 1:
+				if ws.ws2811_leds_set(self.channel, start, stop, value) < 0:
+					raise ValueError('LED colors must be 32-bit integers')
+			else:
+				for n, color in zip(range(start, stop, step), value):
+					ws.ws2811_led_set(self.channel, n, color)
 		# Else assume the passed in value is a number to the position.
 		else:
 			return ws.ws2811_led_set(self.channel, pos, value)
 
 
 class Adafruit_NeoPixel(object):
-	def __init__(self, num, pin, freq_hz=800000, dma=5, invert=False, brightness=255, channel=0):
+	def __init__(self, num, pin, freq_hz=800000, dma=5, invert=False, brightness=255, channel=0,
+			background=False):
 		"""Class to represent a NeoPixel/WS281x LED display.  Num should be the
 		number of pixels in the display, and pin should be the GPIO pin connected
 		to the display signal line (must be a PWM pin like 18!).  Optional
 		parameters are freq, the frequency of the display signal in hertz (default
 		800khz), dma, the DMA channel to use (default 5), invert, a boolean
 		specifying if the signal line should be inverted (default False), and
-		channel, the PWM channel to use (defaults to 0).
+		channel, the PWM channel to use (defaults to 0).  With background set to
+		True, show() hands the frame to a native thread and returns right away,
+		so the next frame can be computed while this one is sent out.
 		"""
 		# Create ws2811_t structure and fill in parameters.
 		self._leds = ws.new_ws2811_t()
@@ -82,9 +88,15 @@ class Adafruit_NeoPixel(object):
 		# Grab the led data array.
 		self._led_data = _LED_Data(self._channel, num)
 
+		self._background = background
+		self._renderer = None
+
 	def __del__(self):
 		# Clean up memory used by the library when not needed anymore.
 		if self._leds is not None:
+			if self._renderer is not None:
+				ws.ws2811_renderer_stop(self._renderer)
+				self._renderer = None
 			ws.ws2811_fini(self._leds)
 			ws.delete_ws2811_t(self._leds)
 			self._leds = None
@@ -98,13 +110,40 @@ class Adafruit_NeoPixel(object):
 		resp = ws.ws2811_init(self._leds)
 		if resp != 0:
 			raise RuntimeError('ws2811_init failed with code {0}'.format(resp))
-		
-	def show(self):
-		"""Update the display with the data from the LED buffer."""
-		resp = ws.ws2811_render(self._leds)
+		if self._background:
+			self._renderer = ws.ws2811_renderer_start(self._leds)
+			if self._renderer is None:
+				raise RuntimeError('Failed to start the render thread')
+
+	def show(self, wait=True):
+		"""Update the display with the data from the LED buffer.  In the
+		background mode the buffer is copied and rendered by the render thread,
+		and this only waits while the previous frame hasn't been taken up yet.
+		With wait set to False it replaces that frame instead, so a fast
+		animation drops frames rather than falling behind.
+		"""
+		if self._renderer is not None:
+			resp = ws.ws2811_renderer_show(self._renderer, 1 if wait else 0)
+		else:
+			resp = ws.ws2811_render(self._leds)
 		if resp != 0:
 			raise RuntimeError('ws2811_render failed with code {0}'.format(resp))
 
+	def sync(self):
+		"""Wait until every frame passed to show() has been sent to the LEDs."""
+		if self._renderer is not None:
+			resp = ws.ws2811_renderer_wait(self._renderer)
+			if resp != 0:
+				raise RuntimeError('ws2811_render failed with code {0}'.format(resp))
+
+	def droppedFrames(self):
+		"""Return how many frames show(wait=False) replaced before the render
+		thread got to them.
+		"""
+		if self._renderer is None:
+			return 0
+		return ws.ws2811_renderer_dropped(self._renderer)
+
 	def setPixelColor(self, n, color):
 		"""Set LED at position n to the provided 24-bit color value (in RGB order).
 		"""
@@ -123,12 +162,62 @@ class Adafruit_NeoPixel(object):
 		"""
 		ws.ws2811_channel_t_brightness_set(self._channel, brightness)
 
+	def setGamma(self, gamma):
+		"""Apply a gamma curve with the provided exponent (e.g. 2.2) to every LED
+		when the buffer is sent out.  A gamma of 0 or 1.0 turns correction off.
+		"""
+		ws.ws2811_channel_t_gamma_set(self._channel, gamma)
+
+	def setWhiteBalance(self, red, green, blue):
+		"""Scale each color of every LED by the provided gain when the buffer is
+		sent out.  Each gain is a value from 0 to 255, where 255 leaves the color
+		unchanged.  Setting all three to 0 turns correction off, the same as 255,
+		255, 255; use setBrightness(0) to blank the LEDs.
+		"""
+		ws.ws2811_channel_t_white_balance_set(self._channel, Color(red, green, blue))
+
 	def getPixels(self):
 		"""Return an object which allows access to the LED display data as if 
 		it were a sequence of 24-bit RGB values.
 		"""
 		return self._led_data
 
+	def setPixels(self, pixels, start=0):
+		"""Set consecutive LEDs, starting at position start, to the provided
+		24-bit color values in one go.  Pixels can be a list of ints, an
+		array('I') or a numpy uint32 array.
+		"""
+		if ws.ws2811_leds_set(self._channel, start, self.numPixels(), pixels) < 0:
+			raise ValueError('LED colors must be 32-bit integers')
+
+	def fill(self, color, start=0, end=None):
+		"""Set the LEDs from position start up to, not including, end (default
+		all of them) to the provided 24-bit color value.
+		"""
+		if end is None:
+			end = self.numPixels()
+		if ws.ws2811_leds_fill(self._channel, start, end, color) < 0:
+			raise ValueError('Invalid LED range {0} to {1}'.format(start, end))
+
+	def getBuffer(self):
+		"""Return a writable view of the LED buffer itself, one 24-bit RGB
+		value per LED, without copying.  Only valid between begin() and the
+		deletion of this object.
+		"""
+		buf = ws.ws2811_leds_buffer(self._channel)
+		if buf is None:
+			raise RuntimeError('LED buffer not allocated, call begin() first')
+		# Python 2 buffers can't be cast, numpy.frombuffer still takes them
+		return buf.cast('I') if hasattr(buf, 'cast') else buf
+
+	def getArray(self):
+		"""Return the LED buffer as a numpy uint32 array sharing its memory, so
+		whole frames can be computed with numpy and shown without copying.
+		Only valid between begin() and the deletion of this object.
+		"""
+		import numpy
+		return numpy.frombuffer(self.getBuffer(), dtype=numpy.uint32)
+
 	def numPixels(self):
 		"""Return the number of pixels in the display."""
 		return ws.ws2811_channel_t_count_get(self._channel)
@@ -15,6 +15,25 @@
 #include "../ws2811.h"
 %}
 
+// Let other Python threads run while these wait for the DMA.
+%exception ws2811_render {
+    Py_BEGIN_ALLOW_THREADS
+    $action
+    Py_END_ALLOW_THREADS
+}
+
+%exception ws2811_wait {
+    Py_BEGIN_ALLOW_THREADS
+    $action
+    Py_END_ALLOW_THREADS
+}
+
+%exception ws2811_present {
+    Py_BEGIN_ALLOW_THREADS
+    $action
+    Py_END_ALLOW_THREADS
+}
+
 // Process ws2811.h header and export all included functions.
 %include "../ws2811.h"
 
@@ -45,4 +64,356 @@
     {
         return &ws->channel[channelnum];
     }
+
+    // Writable view of a channel's LEDs, valid until ws2811_fini() or
+    // ws2811_reconfigure().  NumPy can wrap it with numpy.frombuffer(view, numpy.uint32).
+    PyObject *ws2811_leds_buffer(ws2811_channel_t *channel)
+    {
+        if (!channel->leds)
+        {
+            Py_RETURN_NONE;
+        }
+
+#if PY_VERSION_HEX >= 0x03030000
+        return PyMemoryView_FromMemory((char *)channel->leds,
+                                       channel->count * sizeof(ws2811_led_t), PyBUF_WRITE);
+#else
+        return PyBuffer_FromReadWriteMemory(channel->leds,
+                                            channel->count * sizeof(ws2811_led_t));
+#endif
+    }
+
+    // Copy colors into LEDs start to end, from a buffer of 32 bit values (array('I'),
+    // a numpy.uint32 array) or any sequence of ints, in one call.  Returns the number
+    // of LEDs set, -1 if pixels isn't usable.
+    int ws2811_leds_set(ws2811_channel_t *channel, int start, int end, PyObject *pixels)
+    {
+        Py_buffer view;
+        PyObject *seq;
+        int count, i;
+
+        if (end > channel->count)
+        {
+            end = channel->count;
+        }
+
+        if (!channel->leds || (start < 0) || (start > end))
+        {
+            return -1;
+        }
+
+        if (PyObject_CheckBuffer(pixels))
+        {
+            if (PyObject_GetBuffer(pixels, &view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT))
+            {
+                PyErr_Clear();
+                return -1;
+            }
+
+            if (view.itemsize != sizeof(ws2811_led_t))
+            {
+                PyBuffer_Release(&view);
+                return -1;
+            }
+
+            count = view.len / sizeof(ws2811_led_t);
+            if (count > (end - start))
+            {
+                count = end - start;
+            }
+
+            memcpy(&channel->leds[start], view.buf, count * sizeof(ws2811_led_t));
+            PyBuffer_Release(&view);
+
+            return count;
+        }
+
+        seq = PySequence_Fast(pixels, "");
+        if (!seq)
+        {
+            PyErr_Clear();
+            return -1;
+        }
+
+        count = PySequence_Fast_GET_SIZE(seq);
+        if (count > (end - start))
+        {
+            count = end - start;
+        }
+
+        for (i = 0; i < count; i++)
+        {
+            PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+            unsigned long color;
+
+#if PY_VERSION_HEX >= 0x03000000
+            color = PyLong_AsUnsignedLongMask(item);
+#else
+            color = PyInt_AsUnsignedLongMask(item);
+#endif
+            if ((color == (unsigned long)-1) && PyErr_Occurred())
+            {
+                PyErr_Clear();
+                count = -1;
+                break;
+            }
+
+            channel->leds[start + i] = color;
+        }
+        Py_DECREF(seq);
+
+        return count;
+    }
+
+    // Set LEDs start to end to one color.  Returns the number of LEDs set.
+    int ws2811_leds_fill(ws2811_channel_t *channel, int start, int end, uint32_t color)
+    {
+        int i;
+
+        if (end > channel->count)
+        {
+            end = channel->count;
+        }
+
+        if (!channel->leds || (start < 0) || (start > end))
+        {
+            return -1;
+        }
+
+        for (i = start; i < end; i++)
+        {
+            channel->leds[i] = color;
+        }
+
+        return end - start;
+    }
+%}
+
+// Background rendering.  ws2811_renderer_show() snapshots the LEDs and hands them to a
+// native thread, which renders them while Python goes on with the next frame.
+%{
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ws2811_renderer
+{
+    ws2811_t *ws2811;                            // Instance Python draws into
+    ws2811_t frame[2];                           // Snapshots, one filled while one renders
+    int size[2][RPI_PWM_CHANNELS];               // LEDs allocated per snapshot and channel
+    int fill;                                    // Snapshot show() fills next
+    int queued;                                  // Snapshot filled, not taken yet
+    int busy;                                    // Thread is rendering
+    int stop;
+    int result;                                  // Render error since the last show()
+    unsigned long dropped;                       // Frames replaced before they were taken
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+};
+
+static void *renderer_thread(void *arg)
+{
+    struct ws2811_renderer *r = arg;
+
+    pthread_mutex_lock(&r->lock);
+
+    // A queued frame still goes out when stopping
+    while (r->queued || !r->stop)
+    {
+        int frame, ret;
+
+        if (!r->queued)
+        {
+            pthread_cond_wait(&r->cond, &r->lock);
+            continue;
+        }
+
+        frame = r->fill;
+        r->fill ^= 1;
+        r->queued = 0;
+        r->busy = 1;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+
+        ret = ws2811_render(&r->frame[frame]);
+
+        pthread_mutex_lock(&r->lock);
+        r->busy = 0;
+        if (ret)
+        {
+            r->result = ret;
+        }
+        pthread_cond_broadcast(&r->cond);
+    }
+
+    pthread_mutex_unlock(&r->lock);
+
+    return NULL;
+}
+
+// Copy the settings and LEDs into a snapshot.  The device state is shared, so
+// rendering the snapshot is the same as rendering the instance itself.
+static int renderer_snapshot(struct ws2811_renderer *r, int frame)
+{
+    ws2811_t *dst = &r->frame[frame];
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        int count = r->ws2811->channel[chan].count;
+
+        leds[chan] = dst->channel[chan].leds;
+        if (count > r->size[frame][chan])
+        {
+            ws2811_led_t *grown = realloc(leds[chan], count * sizeof(ws2811_led_t));
+
+            if (!grown)
+            {
+                return -1;
+            }
+            leds[chan] = dst->channel[chan].leds = grown;
+            r->size[frame][chan] = count;
+        }
+    }
+
+    *dst = *r->ws2811;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        dst->channel[chan].leds = leds[chan];
+        if (dst->channel[chan].count)
+        {
+            memcpy(leds[chan], r->ws2811->channel[chan].leds,
+                   dst->channel[chan].count * sizeof(ws2811_led_t));
+        }
+    }
+
+    return 0;
+}
+
+// Start rendering in the background, after ws2811_init().  Don't call ws2811_render()
+// on the instance directly until ws2811_renderer_stop().
+struct ws2811_renderer *ws2811_renderer_start(ws2811_t *ws2811)
+{
+    struct ws2811_renderer *r = calloc(1, sizeof(*r));
+
+    if (!r)
+    {
+        return NULL;
+    }
+
+    r->ws2811 = ws2811;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+
+    if (pthread_create(&r->thread, NULL, renderer_thread, r))
+    {
+        pthread_cond_destroy(&r->cond);
+        pthread_mutex_destroy(&r->lock);
+        free(r);
+        return NULL;
+    }
+
+    return r;
+}
+
+// Queue the current LEDs for rendering and return without waiting for the DMA.  If
+// a frame is still queued, wait for the thread to take it, or with wait 0 replace
+// it.  Returns a render error since the last call, 0 if none.
+int ws2811_renderer_show(struct ws2811_renderer *r, int wait)
+{
+    int ret;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&r->lock);
+
+    while (wait && r->queued)
+    {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+
+    if (r->queued)
+    {
+        r->dropped++;
+    }
+
+    ret = renderer_snapshot(r, r->fill);
+    if (!ret)
+    {
+        r->queued = 1;
+        pthread_cond_broadcast(&r->cond);
+        ret = r->result;
+        r->result = 0;
+    }
+
+    pthread_mutex_unlock(&r->lock);
+    Py_END_ALLOW_THREADS
+
+    return ret;
+}
+
+// Wait until every shown frame was rendered.  Returns a render error since the last
+// call, 0 if none.
+int ws2811_renderer_wait(struct ws2811_renderer *r)
+{
+    int ret;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&r->lock);
+
+    while (r->queued || r->busy)
+    {
+        pthread_cond_wait(&r->cond, &r->lock);
+    }
+
+    ret = r->result;
+    r->result = 0;
+
+    pthread_mutex_unlock(&r->lock);
+    Py_END_ALLOW_THREADS
+
+    return ret;
+}
+
+// Frames replaced by ws2811_renderer_show() before they were rendered.
+unsigned long ws2811_renderer_dropped(struct ws2811_renderer *r)
+{
+    return r->dropped;
+}
+
+// Render what's queued, stop the thread and free the renderer.
+void ws2811_renderer_stop(struct ws2811_renderer *r)
+{
+    int i, chan;
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&r->lock);
+    r->stop = 1;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+
+    pthread_join(r->thread, NULL);
+    Py_END_ALLOW_THREADS
+
+    for (i = 0; i < 2; i++)
+    {
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            free(r->frame[i].channel[chan].leds);
+        }
+    }
+
+    pthread_cond_destroy(&r->cond);
+    pthread_mutex_destroy(&r->lock);
+    free(r);
+}
 %}
+
+struct ws2811_renderer;
+struct ws2811_renderer *ws2811_renderer_start(ws2811_t *ws2811);
+int ws2811_renderer_show(struct ws2811_renderer *r, int wait);
+int ws2811_renderer_wait(struct ws2811_renderer *r);
+unsigned long ws2811_renderer_dropped(struct ws2811_renderer *r);
+void ws2811_renderer_stop(struct ws2811_renderer *r);
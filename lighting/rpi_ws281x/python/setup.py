@@ -15,4 +15,4 @@ setup(name              = 'rpi_ws281x',
       ext_modules       = [Extension('_rpi_ws281x', 
                                      sources=['rpi_ws281x.i'],
                                      library_dirs=['../.'],
-                                     libraries=['ws2811'])])
+                                     libraries=['ws2811', 'm', 'pthread'])])
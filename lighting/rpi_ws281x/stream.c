@@ -0,0 +1,608 @@
+/*
+ * stream.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "ws2811.h"
+#include "stream.h"
+
+
+// Skip and run counts ahead of each run
+#define RUN_HEADER_BYTES                         4
+
+// Records start on a 4 byte boundary
+#define RECORD_ALIGN(size)                       (((size) + 3) & ~3)
+#define INDEX_ALIGN                              8
+#define INDEX_ALIGN_PAD(offset)                  ((INDEX_ALIGN - ((offset) % INDEX_ALIGN)) % INDEX_ALIGN)
+
+// Index entries to allocate at a time while writing
+#define INDEX_GROW                               64
+
+
+/**
+ * Read a 16 bit little endian count.
+ *
+ * @param    p       Pointer to the count.
+ *
+ * @returns  Count.
+ */
+static inline uint32_t run_count(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+/**
+ * Decode the runs of one channel.
+ *
+ * @param    leds    LEDs of the channel, holding the frame the runs apply to.
+ * @param    count   LEDs the runs cover.
+ * @param    p       Start of the channel's runs.
+ * @param    end     End of the payload.
+ *
+ * @returns  Start of the next channel's runs, or NULL if the payload is corrupt.
+ */
+static const uint8_t *channel_decode(ws2811_led_t *leds, uint32_t count, const uint8_t *p,
+                                     const uint8_t *end)
+{
+    uint32_t pos = 0;
+
+    while (pos < count)
+    {
+        uint32_t skip, len, i;
+
+        if ((end - p) < RUN_HEADER_BYTES)
+        {
+            return NULL;
+        }
+
+        skip = run_count(p);
+        len = run_count(p + 2);
+        p += RUN_HEADER_BYTES;
+
+        if (((pos + skip + len) > count) || ((uint32_t)(end - p) < (len * WS2811_STREAM_LED_BYTES)))
+        {
+            return NULL;
+        }
+
+        pos += skip;
+        for (i = 0; i < len; i++)
+        {
+            leds[pos + i] = p[0] | (p[1] << 8) | (p[2] << 16);
+            p += WS2811_STREAM_LED_BYTES;
+        }
+        pos += len;
+    }
+
+    return p;
+}
+
+/**
+ * Map a stream file for playback and check its header and index.  Playback starts
+ * at the first frame.
+ *
+ * @param    stream  Stream to fill in.
+ * @param    path    File name.
+ *
+ * @returns  0 on success, -1 if the file can't be read or isn't a valid stream.
+ */
+int ws2811_stream_open(ws2811_stream_t *stream, const char *path)
+{
+    const ws2811_stream_header_t *header;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return -1;
+    }
+
+    if (fstat(fd, &st) || (st.st_size < sizeof(*header)))
+    {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        return -1;
+    }
+
+    // Frames are read front to back, let the kernel read ahead
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+    header = map;
+    if ((header->magic != WS2811_STREAM_MAGIC) ||
+        (header->version != WS2811_STREAM_VERSION) ||
+        (header->channels != RPI_PWM_CHANNELS) ||
+        (header->index_offset > st.st_size) ||
+        (header->index_offset % INDEX_ALIGN) ||
+        (header->keyframes > ((st.st_size - header->index_offset) / sizeof(ws2811_stream_index_t))))
+    {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    stream->map = map;
+    stream->size = st.st_size;
+    stream->header = header;
+    stream->index = (const ws2811_stream_index_t *)(stream->map + header->index_offset);
+    stream->frame = 0;
+    stream->offset = sizeof(*header);
+
+    return 0;
+}
+
+/**
+ * Unmap a stream file.
+ *
+ * @param    stream  Stream from ws2811_stream_open().
+ *
+ * @returns  None
+ */
+void ws2811_stream_close(ws2811_stream_t *stream)
+{
+    munmap((void *)stream->map, stream->size);
+    stream->map = NULL;
+}
+
+/**
+ * Decode the next frame into LED arrays holding the previous frame.  Only the LEDs
+ * that changed are written, so ws2811_render() only encodes those.
+ *
+ * @param    stream  Stream from ws2811_stream_open().
+ * @param    leds    LED array of each channel, at least the stream's count long.
+ *
+ * @returns  1 if a frame was decoded, 0 at the end of the stream, -1 if it's corrupt.
+ */
+int ws2811_stream_decode(ws2811_stream_t *stream, ws2811_led_t *const *leds)
+{
+    const ws2811_stream_header_t *header = stream->header;
+    const ws2811_stream_frame_t *frame;
+    const uint8_t *p, *end;
+    int chan;
+
+    if (stream->frame >= header->frames)
+    {
+        return 0;
+    }
+
+    if ((stream->offset + sizeof(*frame)) > header->index_offset)
+    {
+        return -1;
+    }
+
+    frame = (const ws2811_stream_frame_t *)(stream->map + stream->offset);
+    p = (const uint8_t *)&frame[1];
+    if (frame->size > (header->index_offset - stream->offset - sizeof(*frame)))
+    {
+        return -1;
+    }
+    end = p + frame->size;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (frame->type == WS2811_STREAM_KEY)
+        {
+            memset(leds[chan], 0, sizeof(ws2811_led_t) * header->count[chan]);
+        }
+
+        p = channel_decode(leds[chan], header->count[chan], p, end);
+        if (!p)
+        {
+            return -1;
+        }
+    }
+
+    stream->frame++;
+    stream->offset += RECORD_ALIGN(sizeof(*frame) + frame->size);
+
+    return 1;
+}
+
+/**
+ * Decode the next frame into the LED arrays, for ws2811_render() to send.  Call at
+ * the stream's frame rate, with ws2811_set_fps() and ws2811_present() for example.
+ *
+ * @param    stream  Stream from ws2811_stream_open().
+ * @param    ws2811  ws2811 instance pointer, with at least the stream's LED counts.
+ *
+ * @returns  1 if a frame was decoded, 0 at the end of the stream, -1 on error.
+ */
+int ws2811_stream_next(ws2811_stream_t *stream, ws2811_t *ws2811)
+{
+    ws2811_led_t *leds[RPI_PWM_CHANNELS];
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].count < stream->header->count[chan])
+        {
+            return -1;
+        }
+
+        leds[chan] = ws2811->channel[chan].leds;
+    }
+
+    return ws2811_stream_decode(stream, leds);
+}
+
+/**
+ * Position the stream so the next frame decoded is the given one.  Decoding starts
+ * from the closest keyframe before it, found through the index.
+ *
+ * @param    stream  Stream from ws2811_stream_open().
+ * @param    ws2811  ws2811 instance pointer, with at least the stream's LED counts.
+ * @param    frame   Frame number.
+ *
+ * @returns  0 on success, -1 if out of range or on error.
+ */
+int ws2811_stream_seek(ws2811_stream_t *stream, ws2811_t *ws2811, uint32_t frame)
+{
+    const ws2811_stream_header_t *header = stream->header;
+    uint32_t lo = 0, hi = header->keyframes;
+
+    if ((frame >= header->frames) || !header->keyframes || (stream->index[0].frame > frame))
+    {
+        return -1;
+    }
+
+    // Last keyframe at or before the frame
+    while ((hi - lo) > 1)
+    {
+        uint32_t mid = (lo + hi) / 2;
+
+        if (stream->index[mid].frame <= frame)
+        {
+            lo = mid;
+        }
+        else
+        {
+            hi = mid;
+        }
+    }
+
+    if (stream->index[lo].offset >= header->index_offset)
+    {
+        return -1;
+    }
+
+    stream->frame = stream->index[lo].frame;
+    stream->offset = stream->index[lo].offset;
+
+    while (stream->frame < frame)
+    {
+        if (ws2811_stream_next(stream, ws2811) != 1)
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Start writing a stream file.
+ *
+ * @param    writer             Writer to fill in.
+ * @param    path               File name, replaced if it exists.
+ * @param    count              LEDs per channel.
+ * @param    fps                Frames per second to play at.
+ * @param    keyframe_interval  Frames between keyframes, the seek granularity.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_stream_create(ws2811_stream_writer_t *writer, const char *path, const int *count,
+                         int fps, int keyframe_interval)
+{
+    size_t payload = 0;
+    int chan;
+
+    // A stream without any LEDs would be nothing but empty frames
+    if ((fps <= 0) || (keyframe_interval <= 0) || ((count[0] + count[1]) == 0))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    memset(writer, 0, sizeof(*writer));
+    writer->header.magic = WS2811_STREAM_MAGIC;
+    writer->header.version = WS2811_STREAM_VERSION;
+    writer->header.channels = RPI_PWM_CHANNELS;
+    writer->header.fps = fps;
+    writer->keyframe_interval = keyframe_interval;
+    writer->offset = sizeof(writer->header);
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (count[chan] < 0)
+        {
+            goto err;
+        }
+
+        writer->header.count[chan] = count[chan];
+        writer->prev[chan] = calloc(count[chan] + 1, sizeof(ws2811_led_t));
+        if (!writer->prev[chan])
+        {
+            goto err;
+        }
+
+        // Worst case, a run per LED
+        payload += count[chan] * (RUN_HEADER_BYTES + WS2811_STREAM_LED_BYTES);
+    }
+
+    writer->payload = malloc(payload + sizeof(ws2811_stream_frame_t) + 4);
+    if (!writer->payload)
+    {
+        goto err;
+    }
+
+    writer->file = fopen(path, "wb");
+    if (!writer->file)
+    {
+        goto err;
+    }
+
+    // Filled in by ws2811_stream_finish()
+    if (fwrite(&writer->header, sizeof(writer->header), 1, writer->file) != 1)
+    {
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if (writer->file)
+    {
+        fclose(writer->file);
+    }
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        free(writer->prev[chan]);
+    }
+    free(writer->payload);
+
+    return -1;
+}
+
+/**
+ * Append a run to a payload.
+ *
+ * @param    p       Where to write the run.
+ * @param    skip    LEDs to skip.
+ * @param    leds    LEDs of the run.
+ * @param    len     Number of LEDs in the run.
+ *
+ * @returns  End of the run.
+ */
+static uint8_t *run_write(uint8_t *p, uint32_t skip, const ws2811_led_t *leds, uint32_t len)
+{
+    uint32_t i;
+
+    p[0] = skip;
+    p[1] = skip >> 8;
+    p[2] = len;
+    p[3] = len >> 8;
+    p += RUN_HEADER_BYTES;
+
+    for (i = 0; i < len; i++)
+    {
+        p[0] = leds[i];
+        p[1] = leds[i] >> 8;
+        p[2] = leds[i] >> 16;
+        p += WS2811_STREAM_LED_BYTES;
+    }
+
+    return p;
+}
+
+/**
+ * Encode the runs of one channel, the LEDs that differ from the previous frame.  A
+ * single unchanged LED between two changed ones is cheaper to store than a new run.
+ *
+ * @param    p       Where to write the runs.
+ * @param    leds    LEDs of the channel.
+ * @param    prev    LEDs the runs apply to.
+ * @param    count   Number of LEDs.
+ *
+ * @returns  End of the runs.
+ */
+static uint8_t *channel_encode(uint8_t *p, const ws2811_led_t *leds, const ws2811_led_t *prev,
+                               uint32_t count)
+{
+    uint32_t pos = 0;
+
+    while (pos < count)
+    {
+        uint32_t start = pos, end;
+
+        while ((start < count) && ((leds[start] & 0xffffff) == prev[start]))
+        {
+            start++;
+        }
+
+        while ((start - pos) > WS2811_STREAM_RUN_MAX)
+        {
+            p = run_write(p, WS2811_STREAM_RUN_MAX, NULL, 0);
+            pos += WS2811_STREAM_RUN_MAX;
+        }
+
+        for (end = start; (end < count) && ((end - start) < WS2811_STREAM_RUN_MAX); end++)
+        {
+            if ((leds[end] & 0xffffff) != prev[end])
+            {
+                continue;
+            }
+
+            if (((end + 1) < count) && ((end + 1 - start) < WS2811_STREAM_RUN_MAX) &&
+                ((leds[end + 1] & 0xffffff) != prev[end + 1]))
+            {
+                end++;
+                continue;
+            }
+
+            break;
+        }
+
+        p = run_write(p, start - pos, &leds[start], end - start);
+        pos = end;
+    }
+
+    return p;
+}
+
+/**
+ * Append a frame to a stream file.  Every keyframe_interval frames a keyframe is
+ * written, otherwise a delta against the previous frame.
+ *
+ * @param    writer  Writer from ws2811_stream_create().
+ * @param    leds    LED array of each channel, the counts given when creating it.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_stream_write(ws2811_stream_writer_t *writer, const ws2811_led_t *const *leds)
+{
+    ws2811_stream_header_t *header = &writer->header;
+    ws2811_stream_frame_t *frame = (ws2811_stream_frame_t *)writer->payload;
+    uint8_t *p = (uint8_t *)&frame[1];
+    size_t size;
+    int key = !(header->frames % writer->keyframe_interval);
+    int chan;
+    uint32_t i;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (key)
+        {
+            memset(writer->prev[chan], 0, sizeof(ws2811_led_t) * header->count[chan]);
+        }
+
+        p = channel_encode(p, leds[chan], writer->prev[chan], header->count[chan]);
+
+        for (i = 0; i < header->count[chan]; i++)
+        {
+            writer->prev[chan][i] = leds[chan][i] & 0xffffff;
+        }
+    }
+
+    frame->size = p - (uint8_t *)&frame[1];
+    frame->type = key ? WS2811_STREAM_KEY : WS2811_STREAM_DELTA;
+    frame->reserved = 0;
+
+    size = RECORD_ALIGN(sizeof(*frame) + frame->size);
+    memset(p, 0, size - (sizeof(*frame) + frame->size));
+
+    if (key)
+    {
+        if (header->keyframes == writer->index_size)
+        {
+            ws2811_stream_index_t *index;
+
+            index = realloc(writer->index, sizeof(*index) * (writer->index_size + INDEX_GROW));
+            if (!index)
+            {
+                return -1;
+            }
+
+            writer->index = index;
+            writer->index_size += INDEX_GROW;
+        }
+
+        writer->index[header->keyframes].frame = header->frames;
+        writer->index[header->keyframes].reserved = 0;
+        writer->index[header->keyframes].offset = writer->offset;
+        header->keyframes++;
+    }
+
+    if (fwrite(frame, size, 1, writer->file) != 1)
+    {
+        return -1;
+    }
+
+    writer->offset += size;
+    header->frames++;
+
+    return 0;
+}
+
+/**
+ * Write the index and header and close a stream file.
+ *
+ * @param    writer  Writer from ws2811_stream_create().
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_stream_finish(ws2811_stream_writer_t *writer)
+{
+    static const uint8_t pad[INDEX_ALIGN];
+    ws2811_stream_header_t *header = &writer->header;
+    size_t padding = INDEX_ALIGN_PAD(writer->offset);
+    int ret = 0;
+    int chan;
+
+    // Players read the index straight from the mapped file, 64-bit offsets and all
+    header->index_offset = writer->offset + padding;
+
+    if ((padding && (fwrite(pad, 1, padding, writer->file) != padding)) ||
+        (header->keyframes &&
+         (fwrite(writer->index, sizeof(*writer->index), header->keyframes, writer->file) !=
+          header->keyframes)) ||
+        fseek(writer->file, 0, SEEK_SET) ||
+        (fwrite(header, sizeof(*header), 1, writer->file) != 1))
+    {
+        ret = -1;
+    }
+
+    if (fclose(writer->file))
+    {
+        ret = -1;
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        free(writer->prev[chan]);
+    }
+    free(writer->payload);
+    free(writer->index);
+
+    return ret;
+}
@@ -0,0 +1,125 @@
+/*
+ * stream.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __STREAM_H__
+#define __STREAM_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ws2811.h"
+
+/*
+ * Frame stream files, for long shows played back through ws2811_render().
+ *
+ * All values are little endian.  The file starts with a header, followed by the
+ * frame records and the seek index.  Each record is a frame header and a payload of
+ * runs for each channel in turn, a 16 bit count of LEDs to skip, a 16 bit count of
+ * LEDs that follow, and those LEDs as 3 bytes each (blue, green, red).  The runs of
+ * a channel add up to its LED count.  A keyframe's runs apply to an all black
+ * frame, a delta frame's to the previous frame, so unchanged LEDs cost nothing.
+ * Records are padded to a multiple of 4 bytes.  The index lists the file offset
+ * of every keyframe, so playback can start anywhere.
+ */
+
+#define WS2811_STREAM_MAGIC                      0x534c5357   // "WSLS"
+#define WS2811_STREAM_VERSION                    1
+
+#define WS2811_STREAM_KEY                        0            // Runs apply to black
+#define WS2811_STREAM_DELTA                      1            // Runs apply to the last frame
+
+#define WS2811_STREAM_RUN_MAX                    0xffff       // LEDs per skip or run
+#define WS2811_STREAM_LED_BYTES                  3
+
+typedef struct
+{
+    uint32_t magic;                              //< WS2811_STREAM_MAGIC
+    uint16_t version;                            //< WS2811_STREAM_VERSION
+    uint16_t channels;                           //< RPI_PWM_CHANNELS
+    uint32_t count[RPI_PWM_CHANNELS];            //< LEDs per channel
+    uint32_t fps;                                //< Frames per second to play at
+    uint32_t frames;                             //< Number of frame records
+    uint32_t keyframes;                          //< Number of index entries
+    uint32_t reserved;
+    uint64_t index_offset;                       //< File offset of the index, a multiple of 8
+} ws2811_stream_header_t;
+
+typedef struct
+{
+    uint32_t size;                               //< Payload bytes, without padding
+    uint16_t type;                               //< WS2811_STREAM_KEY or WS2811_STREAM_DELTA
+    uint16_t reserved;
+} ws2811_stream_frame_t;
+
+typedef struct
+{
+    uint32_t frame;                              //< Keyframe number
+    uint32_t reserved;
+    uint64_t offset;                             //< File offset of its record
+} ws2811_stream_index_t;
+
+// Playback state of a memory mapped stream file
+typedef struct
+{
+    const uint8_t *map;
+    size_t size;
+    const ws2811_stream_header_t *header;
+    const ws2811_stream_index_t *index;
+    uint32_t frame;                              //< Next frame to decode
+    uint64_t offset;                             //< File offset of its record
+} ws2811_stream_t;
+
+// State of a stream file being written
+typedef struct
+{
+    FILE *file;
+    ws2811_stream_header_t header;
+    uint32_t keyframe_interval;
+    ws2811_led_t *prev[RPI_PWM_CHANNELS];        // Last frame written
+    uint8_t *payload;                            // Large enough for a keyframe of any content
+    ws2811_stream_index_t *index;
+    uint32_t index_size;                         // Entries allocated
+    uint64_t offset;                             // File offset of the next record
+} ws2811_stream_writer_t;
+
+
+int ws2811_stream_open(ws2811_stream_t *stream, const char *path);
+void ws2811_stream_close(ws2811_stream_t *stream);
+int ws2811_stream_decode(ws2811_stream_t *stream, ws2811_led_t *const *leds);
+int ws2811_stream_next(ws2811_stream_t *stream, ws2811_t *ws2811);
+int ws2811_stream_seek(ws2811_stream_t *stream, ws2811_t *ws2811, uint32_t frame);
+
+int ws2811_stream_create(ws2811_stream_writer_t *writer, const char *path, const int *count,
+                         int fps, int keyframe_interval);
+int ws2811_stream_write(ws2811_stream_writer_t *writer, const ws2811_led_t *const *leds);
+int ws2811_stream_finish(ws2811_stream_writer_t *writer);
+
+
+#endif /* __STREAM_H__ */
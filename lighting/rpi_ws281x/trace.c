@@ -0,0 +1,349 @@
+/*
+ * trace.c
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#define _GNU_SOURCE
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+
+#define TRACE_NAMES_MAX                          256
+#define TRACE_NAME_LEN_MAX                       255
+
+
+// One thread's events, written by that thread only
+typedef struct trace_ring
+{
+    struct trace_ring *next;                     // All rings, newest first
+    uint32_t tid;
+    volatile uint32_t head;                      // Events recorded, the newest at head - 1
+    struct
+    {
+        uint64_t ticks;                          // trace_clock() time
+        const char *name;
+        int phase;
+    } events[WS2811_TRACE_EVENTS];
+} trace_ring_t;
+
+volatile int ws2811_trace_enabled;
+
+static trace_ring_t *trace_rings;
+static __thread trace_ring_t *trace_ring;
+
+
+#if defined(__aarch64__)
+/**
+ * Read the clock events are stamped with, the generic timer's virtual counter,
+ * which user space reads in a few cycles.
+ *
+ * @returns  Counter ticks.
+ */
+static inline uint64_t trace_clock(void)
+{
+    uint64_t ticks;
+
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r" (ticks));
+
+    return ticks;
+}
+
+static uint64_t trace_clock_hz(void)
+{
+    uint64_t hz;
+
+    __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (hz));
+
+    return hz;
+}
+#else
+/**
+ * Read the clock events are stamped with.  Without a counter user space can read
+ * directly that's CLOCK_MONOTONIC, at the cost of a clock_gettime() per event.
+ *
+ * @returns  Clock ticks.
+ */
+static inline uint64_t trace_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+static uint64_t trace_clock_hz(void)
+{
+    return 1000000000ULL;
+}
+#endif
+
+/**
+ * Turn recording on or off.  Events recorded so far are kept either way.
+ *
+ * @param    enable  1 to record events, 0 to stop.
+ *
+ * @returns  None
+ */
+void ws2811_trace_enable(int enable)
+{
+    ws2811_trace_enabled = enable;
+}
+
+/**
+ * Set up the calling thread's ring and add it to the list.  Rings stay around after
+ * their thread exits, so its events still make it into the trace.
+ *
+ * @returns  Ring, or NULL if out of memory.
+ */
+static trace_ring_t *trace_ring_create(void)
+{
+    trace_ring_t *ring = calloc(1, sizeof(*ring));
+
+    if (!ring)
+    {
+        return NULL;
+    }
+
+    ring->tid = syscall(SYS_gettid);
+
+    ring->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+    while (!__atomic_compare_exchange_n(&trace_rings, &ring->next, ring, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    trace_ring = ring;
+
+    return ring;
+}
+
+/**
+ * Record an event on the calling thread's ring, overwriting the oldest once it's
+ * full.  Use ws2811_trace() or the TRACE_xxx macros rather than calling this.
+ *
+ * @param    name    Static string naming the event.
+ * @param    phase   WS2811_TRACE_BEGIN, _END or _INSTANT.
+ *
+ * @returns  None
+ */
+void ws2811_trace_record(const char *name, int phase)
+{
+    trace_ring_t *ring = trace_ring;
+    uint64_t ticks = trace_clock();
+    uint32_t head;
+
+    if (!ring && !(ring = trace_ring_create()))
+    {
+        return;
+    }
+
+    head = ring->head;
+    ring->events[head & (WS2811_TRACE_EVENTS - 1)].ticks = ticks;
+    ring->events[head & (WS2811_TRACE_EVENTS - 1)].name = name;
+    ring->events[head & (WS2811_TRACE_EVENTS - 1)].phase = phase;
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Look a name up in the table of names written so far, adding it if new.
+ *
+ * @param    names   Table of names.
+ * @param    count   Number of names in it, updated.
+ * @param    name    Name to look up.
+ *
+ * @returns  Index of the name, -1 if the table is full.
+ */
+static int trace_name_index(const char **names, int *count, const char *name)
+{
+    int i;
+
+    for (i = 0; i < *count; i++)
+    {
+        if ((names[i] == name) || !strcmp(names[i], name))
+        {
+            return i;
+        }
+    }
+
+    if (*count == TRACE_NAMES_MAX)
+    {
+        return -1;
+    }
+
+    names[*count] = name;
+
+    return (*count)++;
+}
+
+/**
+ * Convert a trace_clock() time to CLOCK_MONOTONIC, going by a reference time read
+ * on both clocks.
+ *
+ * @param    ticks      Time to convert.
+ * @param    ref_ticks  Reference time on trace_clock().
+ * @param    ref_ns     The same on CLOCK_MONOTONIC.
+ * @param    hz         trace_clock() ticks per second.
+ *
+ * @returns  CLOCK_MONOTONIC time in ns.
+ */
+static uint64_t trace_ticks_ns(uint64_t ticks, uint64_t ref_ticks, uint64_t ref_ns, uint64_t hz)
+{
+    uint64_t delta = (ticks > ref_ticks) ? (ticks - ref_ticks) : (ref_ticks - ticks);
+
+    // In two parts, so neither overflows
+    delta = ((delta / hz) * 1000000000ULL) + (((delta % hz) * 1000000000ULL) / hz);
+
+    return (ticks > ref_ticks) ? (ref_ns + delta) : (ref_ns - delta);
+}
+
+/**
+ * Write the newest events of every thread to a file, for ledtrace.  Threads keep
+ * recording meanwhile; events they overwrite while being copied are left out.
+ *
+ * @param    path    File to write.
+ *
+ * @returns  0 on success, -1 on error.
+ */
+int ws2811_trace_save(const char *path)
+{
+    ws2811_trace_header_t header =
+    {
+        .magic = WS2811_TRACE_MAGIC,
+        .version = WS2811_TRACE_VERSION,
+        .pid = getpid(),
+    };
+    const char *names[TRACE_NAMES_MAX];
+    ws2811_trace_event_t *events = NULL;
+    uint64_t hz = trace_clock_hz();
+    uint64_t ref_ticks = trace_clock();
+    uint64_t ref_ns;
+    struct timespec ts;
+    trace_ring_t *ring;
+    int name_count = 0;
+    uint32_t count = 0;
+    FILE *file;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ref_ns = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+
+    for (ring = __atomic_load_n(&trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+    {
+        uint32_t copied = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t first = (copied > WS2811_TRACE_EVENTS) ? (copied - WS2811_TRACE_EVENTS) : 0;
+        uint32_t head = copied;
+        ws2811_trace_event_t *grown;
+        uint32_t start = count;
+        uint32_t n;
+
+        grown = realloc(events, (count + (head - first)) * sizeof(*events));
+        if (!grown && (head != first))
+        {
+            free(events);
+            return -1;
+        }
+        events = grown;
+
+        for (n = first; n != head; n++)
+        {
+            int index = trace_name_index(names, &name_count,
+                                         ring->events[n & (WS2811_TRACE_EVENTS - 1)].name);
+
+            if (index < 0)
+            {
+                continue;
+            }
+
+            events[count].ts_ns = trace_ticks_ns(ring->events[n & (WS2811_TRACE_EVENTS - 1)].ticks,
+                                                 ref_ticks, ref_ns, hz);
+            events[count].tid = ring->tid;
+            events[count].name = index;
+            events[count].phase = ring->events[n & (WS2811_TRACE_EVENTS - 1)].phase;
+            events[count].reserved = 0;
+            count++;
+        }
+
+        // If the thread kept recording while we copied, drop what it overwrote, and
+        // the slot it may be writing into now, which holds event head - WS2811_TRACE_EVENTS
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if ((head != copied) && ((head - first) >= WS2811_TRACE_EVENTS))
+        {
+            uint32_t lost = (head - first) - WS2811_TRACE_EVENTS + 1;
+
+            if (lost > (count - start))
+            {
+                lost = count - start;
+            }
+            memmove(&events[start], &events[start + lost],
+                    (count - start - lost) * sizeof(*events));
+            count -= lost;
+        }
+    }
+
+    header.names = name_count;
+    header.events = count;
+
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        free(events);
+        return -1;
+    }
+
+    fwrite(&header, sizeof(header), 1, file);
+    for (i = 0; i < name_count; i++)
+    {
+        size_t len = strlen(names[i]);
+        uint8_t byte = (len > TRACE_NAME_LEN_MAX) ? TRACE_NAME_LEN_MAX : len;
+
+        fwrite(&byte, 1, 1, file);
+        fwrite(names[i], byte, 1, file);
+    }
+    if (count)
+    {
+        fwrite(events, sizeof(*events), count, file);
+    }
+    free(events);
+
+    if (ferror(file))
+    {
+        fclose(file);
+        return -1;
+    }
+
+    return fclose(file) ? -1 : 0;
+}
@@ -0,0 +1,111 @@
+/*
+ * trace.h
+ *
+ * Copyright (c) 2014 Jeremy Garff <jer @ jers.net>
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification, are permitted
+ * provided that the following conditions are met:
+ *
+ *     1.  Redistributions of source code must retain the above copyright notice, this list of
+ *         conditions and the following disclaimer.
+ *     2.  Redistributions in binary form must reproduce the above copyright notice, this list
+ *         of conditions and the following disclaimer in the documentation and/or other materials
+ *         provided with the distribution.
+ *     3.  Neither the name of the owner nor the names of its contributors may be used to endorse
+ *         or promote products derived from this software without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND
+ * FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA,
+ * OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+ * OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <stdint.h>
+
+/*
+ * Trace events for the render path, to see where the time of each frame goes.
+ *
+ * Built in with WS2811_TRACE defined (scons TRACE=1), compiled out otherwise.  Each
+ * thread records into a ring buffer of its own, without locks or system calls, so an
+ * event costs a clock read and a few stores while tracing is on, and a branch while
+ * it's off.  On 64-bit ARM the clock is the generic timer's counter, a few
+ * nanoseconds to read; elsewhere it's clock_gettime(), some 20 to 50 ns per event.
+ * ws2811_trace_save() writes the newest events of all threads to a file, which
+ * ledtrace converts into Chrome trace JSON for chrome://tracing or Perfetto.
+ * Applications can add their own events next to the driver's with the same calls.
+ */
+
+#define WS2811_TRACE_MAGIC                       0x52545357   // "WSTR"
+#define WS2811_TRACE_VERSION                     1
+
+#define WS2811_TRACE_EVENTS                      8192         // Per thread, a power of 2
+
+#define WS2811_TRACE_BEGIN                       'B'          // Phases, as in Chrome traces
+#define WS2811_TRACE_END                         'E'
+#define WS2811_TRACE_INSTANT                     'i'
+
+// Trace file, a header followed by the names and the events
+typedef struct
+{
+    uint32_t magic;                              //< WS2811_TRACE_MAGIC
+    uint16_t version;                            //< WS2811_TRACE_VERSION
+    uint16_t names;                              //< Number of names, each a length byte and text
+    uint32_t events;                             //< Number of events, oldest first per thread
+    uint32_t pid;                                //< Process the events were recorded in
+} ws2811_trace_header_t;
+
+typedef struct
+{
+    uint64_t ts_ns;                              //< CLOCK_MONOTONIC time
+    uint32_t tid;                                //< Thread the event was recorded on
+    uint16_t name;                               //< Index into the names
+    uint8_t phase;                               //< WS2811_TRACE_BEGIN, _END or _INSTANT
+    uint8_t reserved;
+} ws2811_trace_event_t;
+
+
+extern volatile int ws2811_trace_enabled;
+
+void ws2811_trace_enable(int enable);
+void ws2811_trace_record(const char *name, int phase);
+int ws2811_trace_save(const char *path);
+
+/**
+ * Record a trace event, if tracing is on.
+ *
+ * @param    name    Static string naming the event, ends and begins match by name.
+ * @param    phase   WS2811_TRACE_BEGIN, _END or _INSTANT.
+ *
+ * @returns  None
+ */
+static inline void ws2811_trace(const char *name, int phase)
+{
+    if (__builtin_expect(ws2811_trace_enabled, 0))
+    {
+        ws2811_trace_record(name, phase);
+    }
+}
+
+#ifdef WS2811_TRACE
+#define TRACE_BEGIN(name)                        ws2811_trace(name, WS2811_TRACE_BEGIN)
+#define TRACE_END(name)                          ws2811_trace(name, WS2811_TRACE_END)
+#define TRACE_INSTANT(name)                      ws2811_trace(name, WS2811_TRACE_INSTANT)
+#else
+#define TRACE_BEGIN(name)
+#define TRACE_END(name)
+#define TRACE_INSTANT(name)
+#endif
+
+
+#endif /* __TRACE_H__ */
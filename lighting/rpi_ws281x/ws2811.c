@@ -38,6 +38,9 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <signal.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/timerfd.h>
 
 #include "mailbox.h"
 #include "clk.h"
@@ -45,6 +48,8 @@
 #include "dma.h"
 #include "pwm.h"
 #include "rpihw.h"
+#include "encode.h"
+#include "trace.h"
 
 #include "ws2811.h"
 
@@ -53,20 +58,34 @@
 
 #define OSC_FREQ                                 19200000   // crystal frequency
 
-/* 3 colors, 8 bits per byte, 3 symbols per bit + 55uS low for reset signal */
+/* 55uS low for reset signal, sent from a constant zero source after the LED data */
 #define LED_RESET_uS                             55
-#define LED_BIT_COUNT(leds, freq)                ((leds * 3 * 8 * 3) + ((LED_RESET_uS * \
-                                                  (freq * 3)) / 1000000))
 
-// Pad out to the nearest uint32 + 32-bits for idle low/high times the number of channels
-#define PWM_BYTE_COUNT(leds, freq)               (((((LED_BIT_COUNT(leds, freq) >> 3) & ~0x7) + 4) + 4) * \
-                                                  RPI_PWM_CHANNELS)
+// Words per channel for the reset signal, rounded up, + 32-bits for idle low time
+#define RESET_WORDS(freq, symbols)               (((((LED_RESET_uS * ((freq) * (symbols))) / 1000000) + \
+                                                   31) / 32) + 1)
 
-#define SYMBOL_HIGH                              0x6  // 1 1 0
-#define SYMBOL_LOW                               0x4  // 1 0 0
+// Zeros the reset control blocks read from, a control block's worth keeps the alignment
+#define RESET_SRC_BYTES                          32
 
 #define ARRAY_SIZE(stuff)                        (sizeof(stuff) / sizeof(stuff[0]))
 
+// Frames alternate between buffers so one can be filled while the other is sent
+#define PWM_BUFFERS                              2
+
+#define SHADOW_ALIGN                             64   // Cache line size, or a multiple of it
+
+// LEDs compared against the previous frame at a time, a multiple of ENCODE_ALIGN_LEDS
+#define DIRTY_BLOCK_LEDS                         16
+
+// How long to wait before checking again when the DMA outlasts its expected wire time
+#define DMA_RECHECK_NS                           100000
+
+// Longest transfer per control block, what the DMA lite channels can do
+#define CLIP_CB_MAX_BYTES                        0xfffc
+#define CLIP_CBS(bytes)                          (((bytes) + CLIP_CB_MAX_BYTES - 1) / \
+                                                  CLIP_CB_MAX_BYTES)
+
 
 // We use the mailbox interface to request memory from the VideoCore.
 // This lets us request one physically contiguous chunk, find its
@@ -81,19 +100,171 @@ typedef struct videocore_mbox {
     uint8_t *virt_addr;     /* From mapmem() */
 } videocore_mbox_t;
 
+// A sequence of encoded frames in its own mailbox memory, with a chain of control
+// blocks per frame: the LED data, then the reset signal stretched to the frame period.
+struct ws2811_clip
+{
+    videocore_mbox_t mbox;
+    int frames;
+    int frame_cbs;                               // Control blocks per frame
+    volatile dma_cb_t *cb;                       // frames * frame_cbs control blocks
+    volatile uint32_t *data;                     // frames * pwm_words words of LED data
+    uint32_t layout_id;                          // Device layout the frames are encoded for
+    uint64_t period_ns;
+    int loop;                                    // Last frame links back to the first
+    struct ws2811_clip *next;
+};
+
 typedef struct ws2811_device
 {
-    volatile uint8_t *pwm_raw;
+    volatile uint8_t *pwm_raw[PWM_BUFFERS];
+    uint32_t *pwm_shadow;                        // Cached copy of pwm_raw, frames are encoded here
+    int pwm_words;                               // Size of each pwm_raw and pwm_shadow in words
+    int pwm_active;                              // Buffer last handed to the DMA
+    int pwm_dirty_lo[PWM_BUFFERS];               // Words of each buffer that are out of date
+    int pwm_dirty_hi[PWM_BUFFERS];               // with the shadow, [lo, hi)
+    ws2811_led_t *prev_leds[RPI_PWM_CHANNELS];   // LEDs as of the last encode
+    int prev_brightness[RPI_PWM_CHANNELS];
+    int prev_strip_type[RPI_PWM_CHANNELS];
+    float prev_gamma[RPI_PWM_CHANNELS];
+    uint32_t prev_white_balance[RPI_PWM_CHANNELS];
+    encode_lut_t lut[RPI_PWM_CHANNELS];          // Color correction for the settings above
+    int pwm_channels;                            // PWM channels fed from the FIFO, 1 or 2
+    int pwm_channel;                             // The channel in use when there's only 1
+    uint32_t clk_freq;                           // Configuration the hardware is set up for,
+    int clk_symbols;                             // see ws2811_reconfigure
+    uint32_t pwm_ctl;
+    int gpionum[RPI_PWM_CHANNELS];
+    int led_count[RPI_PWM_CHANNELS];             // LEDs the arrays are allocated for
+    int render_all;                              // Encode every LED on the next render
     volatile dma_t *dma;
     volatile pwm_t *pwm;
-    volatile dma_cb_t *dma_cb;
-    uint32_t dma_cb_addr;
+    volatile dma_cb_t *dma_cb[PWM_BUFFERS];      // Sends the LED data of each buffer
+    uint32_t dma_cb_addr[PWM_BUFFERS];
+    volatile dma_cb_t *reset_cb[PWM_BUFFERS];    // Follows with the reset signal, then links on
+    uint32_t reset_cb_addr[PWM_BUFFERS];
+    volatile uint32_t *reset_src;
+    int reset_words;                             // Words of reset signal, all channels
     volatile gpio_t *gpio;
     volatile cm_pwm_t *cm_pwm;
     videocore_mbox_t mbox;
     int max_count;
+    uint64_t wire_ns;                            // Time to send one DMA buffer
+    uint64_t dma_deadline;                       // When the running transfer should be done
+    int dma_pending;                             // Buffer queued by ws2811_render_async, or -1
+    int free_run;                                // DMA repeats the active buffer, see ws2811_set_free_run
+    int timer_fd;                                // Armed for dma_deadline, see ws2811_get_fd
+    uint64_t present_period_ns;                  // Frame period for ws2811_present, 0 for none
+    uint64_t present_deadline;                   // When the next frame is due, 0 to start over
+    uint64_t present_start;                      // When the current schedule started
+    uint64_t present_count;                      // Frames presented on the current schedule
+    uint64_t fps_start;                          // Start of the window stats.fps is counted over
+    uint64_t fps_frames;                         // Frames sent in it
+    uint32_t layout_id;                          // Changed by ws2811_reconfigure, for clips
+    ws2811_clip_t *clips;                        // Every clip, to free them on cleanup
+    ws2811_clip_t *clip_playing;                 // Clip the DMA was started on, if any
+    ws2811_stats_t stats;
 } ws2811_device_t;
 
+/**
+ * Read the monotonic clock.
+ *
+ * @returns  Current time in nanoseconds.
+ */
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/**
+ * Sleep until the given time.
+ *
+ * @param    when    Absolute CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @returns  None
+ */
+static void sleep_until(uint64_t when)
+{
+    struct timespec ts =
+    {
+        .tv_sec = when / 1000000000ULL,
+        .tv_nsec = when % 1000000000ULL,
+    };
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+/**
+ * Count a time in a log2 histogram, see WS2811_STATS_BUCKETS.
+ *
+ * @param    hist    Histogram.
+ * @param    ns      Time in nanoseconds.
+ *
+ * @returns  None
+ */
+static void stats_hist_add(uint32_t *hist, uint64_t ns)
+{
+    uint32_t us = (ns < (1000ULL << 31)) ? (ns / 1000) : 0x80000000;
+    int bucket = us ? (32 - __builtin_clz(us)) : 0;
+
+    if (bucket >= WS2811_STATS_BUCKETS)
+    {
+        bucket = WS2811_STATS_BUCKETS - 1;
+    }
+
+    hist[bucket]++;
+}
+
+/**
+ * Count a frame sent, for the rate over the last second.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void stats_frame_sent(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint64_t now = now_ns();
+
+    device->stats.frames++;
+    device->fps_frames++;
+
+    if ((now - device->fps_start) >= 1000000000ULL)
+    {
+        device->stats.fps = (device->fps_frames * 1000000000.0) / (now - device->fps_start);
+        device->fps_start = now;
+        device->fps_frames = 0;
+    }
+}
+
+/**
+ * Arm the completion timer to fire at the given time.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    when    Absolute CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @returns  None
+ */
+static void timer_arm(ws2811_t *ws2811, uint64_t when)
+{
+    struct itimerspec its =
+    {
+        .it_value =
+        {
+            .tv_sec = when / 1000000000ULL,
+            .tv_nsec = when % 1000000000ULL,
+        },
+    };
+
+    timerfd_settime(ws2811->device->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
 /**
  * Iterate through the channels and find the largest led count.
  *
@@ -116,6 +287,60 @@ static int max_channel_led_count(ws2811_t *ws2811)
     return max;
 }
 
+/**
+ * Work out which PWM channels carry LEDs.  With only one of them in use the FIFO feeds
+ * that channel alone, so the DMA buffer holds just its words back to back instead of
+ * interleaving them with padding for the unused channel.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void pwm_channels_detect(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan, used = 0;
+
+    device->pwm_channels = RPI_PWM_CHANNELS;
+    device->pwm_channel = 0;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].count)
+        {
+            device->pwm_channel = chan;
+            used++;
+        }
+    }
+
+    if (used == 1)
+    {
+        device->pwm_channels = 1;
+    }
+    else
+    {
+        device->pwm_channel = 0;
+    }
+}
+
+/**
+ * Number of words per channel the encoding of a number of LEDs takes, rounded up.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    leds    Number of LEDs.
+ *
+ * @returns  Number of words.
+ */
+static int led_words(ws2811_t *ws2811, int leds)
+{
+    if (ws2811->symbols == WS2811_SYMBOLS_ALIGNED)
+    {
+        return leds * 3;
+    }
+
+    return ENCODE_WORDS(leds * 3);
+}
+
 /**
  * Map all devices into userspace memory.
  *
@@ -238,33 +463,79 @@ static void stop_pwm(ws2811_t *ws2811)
 }
 
 /**
- * Setup the PWM controller in serial mode on both channels using DMA to feed the PWM FIFO.
+ * Setup the PWM clock for the output frequency and symbols per bit.  The PWM has to be
+ * stopped to change it, so this stops it first.
  *
  * @param    ws2811  ws2811 instance pointer.
  *
  * @returns  None
  */
-static int setup_pwm(ws2811_t *ws2811)
+static void setup_clock(ws2811_t *ws2811)
 {
     ws2811_device_t *device = ws2811->device;
-    volatile dma_t *dma = device->dma;
-    volatile dma_cb_t *dma_cb = device->dma_cb;
-    volatile pwm_t *pwm = device->pwm;
     volatile cm_pwm_t *cm_pwm = device->cm_pwm;
-    int maxcount = max_channel_led_count(ws2811);
-    uint32_t freq = ws2811->freq;
-    int32_t byte_count;
 
     stop_pwm(ws2811);
 
-    // Setup the PWM Clock - Use OSC @ 19.2Mhz w/ 3 clocks/tick
-    cm_pwm->div = CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(OSC_FREQ / (3 * freq));
+    // Setup the PWM Clock - Use OSC @ 19.2Mhz w/ 3 or 4 clocks/tick
+    cm_pwm->div = CM_PWM_DIV_PASSWD | CM_PWM_DIV_DIVI(OSC_FREQ / (ws2811->symbols * ws2811->freq));
     cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC;
     cm_pwm->ctl = CM_PWM_CTL_PASSWD | CM_PWM_CTL_SRC_OSC | CM_PWM_CTL_ENAB;
     usleep(10);
     while (!(cm_pwm->ctl & CM_PWM_CTL_BUSY))
         ;
 
+    device->clk_freq = ws2811->freq;
+    device->clk_symbols = ws2811->symbols;
+    device->pwm_ctl = 0;
+}
+
+/**
+ * Work out the PWM control register value for the current configuration.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Control register value, including the channel enables.
+ */
+static uint32_t pwm_ctl_value(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint32_t ctl = 0;
+
+    // Only channels taking part in the layout read from the FIFO, see pwm_channels_detect()
+    if ((device->pwm_channels == RPI_PWM_CHANNELS) || (device->pwm_channel == 0))
+    {
+        ctl |= RPI_PWM_CTL_USEF1 | RPI_PWM_CTL_MODE1 | RPI_PWM_CTL_PWEN1;
+    }
+    if ((device->pwm_channels == RPI_PWM_CHANNELS) || (device->pwm_channel == 1))
+    {
+        ctl |= RPI_PWM_CTL_USEF2 | RPI_PWM_CTL_MODE2 | RPI_PWM_CTL_PWEN2;
+    }
+    if (ws2811->channel[0].invert)
+    {
+        ctl |= RPI_PWM_CTL_POLA1;
+    }
+    if (ws2811->channel[1].invert)
+    {
+        ctl |= RPI_PWM_CTL_POLA2;
+    }
+
+    return ctl;
+}
+
+/**
+ * Setup the PWM controller in serial mode using DMA to feed the PWM FIFO.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void setup_pwm_ctl(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    volatile pwm_t *pwm = device->pwm;
+    uint32_t ctl = pwm_ctl_value(ws2811);
+
     // Setup the PWM, use delays as the block is rumored to lock up without them.  Make
     // sure to use a high enough priority to avoid any FIFO underruns, especially if
     // the CPU is busy doing lots of memory accesses, or another DMA controller is
@@ -277,33 +548,77 @@ static int setup_pwm(ws2811_t *ws2811)
     usleep(10);
     pwm->dmac = RPI_PWM_DMAC_ENAB | RPI_PWM_DMAC_PANIC(7) | RPI_PWM_DMAC_DREQ(3);
     usleep(10);
-    pwm->ctl = RPI_PWM_CTL_USEF1 | RPI_PWM_CTL_MODE1 |
-               RPI_PWM_CTL_USEF2 | RPI_PWM_CTL_MODE2;
-    if (ws2811->channel[0].invert)
-    {
-        pwm->ctl |= RPI_PWM_CTL_POLA1;
-    }
-    if (ws2811->channel[1].invert)
+    pwm->ctl = ctl & ~(RPI_PWM_CTL_PWEN1 | RPI_PWM_CTL_PWEN2);
+    usleep(10);
+    pwm->ctl = ctl;
+
+    device->pwm_ctl = ctl;
+}
+
+/**
+ * Initialize the DMA control blocks, a chain of two per buffer.  The first sends the
+ * LED data from the buffer, the second the reset signal by reading the same zero
+ * word over and over, so the buffers don't need to hold it.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void setup_dma_cbs(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int i;
+
+    for (i = 0; i < PWM_BUFFERS; i++)
     {
-        pwm->ctl |= RPI_PWM_CTL_POLA2;
+        volatile dma_cb_t *dma_cb = device->dma_cb[i];
+        volatile dma_cb_t *reset_cb = device->reset_cb[i];
+
+        dma_cb->ti = RPI_DMA_TI_NO_WIDE_BURSTS |  // 32-bit transfers
+                     RPI_DMA_TI_WAIT_RESP |       // wait for write complete
+                     RPI_DMA_TI_DEST_DREQ |       // user peripheral flow control
+                     RPI_DMA_TI_PERMAP(5) |       // PWM peripheral
+                     RPI_DMA_TI_SRC_INC;          // Increment src addr
+
+        dma_cb->source_ad = addr_to_bus(device, device->pwm_raw[i]);
+
+        dma_cb->dest_ad = (uint32_t)&((pwm_t *)PWM_PERIPH_PHYS)->fif1;
+        dma_cb->txfr_len = device->pwm_words * sizeof(uint32_t);
+        dma_cb->stride = 0;
+        dma_cb->nextconbk = device->reset_cb_addr[i];
+
+        reset_cb->ti = RPI_DMA_TI_NO_WIDE_BURSTS |
+                       RPI_DMA_TI_WAIT_RESP |
+                       RPI_DMA_TI_DEST_DREQ |
+                       RPI_DMA_TI_PERMAP(5);      // Fixed src addr
+
+        reset_cb->source_ad = addr_to_bus(device, device->reset_src);
+
+        reset_cb->dest_ad = (uint32_t)&((pwm_t *)PWM_PERIPH_PHYS)->fif1;
+        reset_cb->txfr_len = device->reset_words * sizeof(uint32_t);
+        reset_cb->stride = 0;
+        reset_cb->nextconbk = 0;
     }
-    usleep(10);
-    pwm->ctl |= RPI_PWM_CTL_PWEN1 | RPI_PWM_CTL_PWEN2;
 
-    // Initialize the DMA control block
-    byte_count = PWM_BYTE_COUNT(maxcount, freq);
-    dma_cb->ti = RPI_DMA_TI_NO_WIDE_BURSTS |  // 32-bit transfers
-                 RPI_DMA_TI_WAIT_RESP |       // wait for write complete
-                 RPI_DMA_TI_DEST_DREQ |       // user peripheral flow control
-                 RPI_DMA_TI_PERMAP(5) |       // PWM peripheral
-                 RPI_DMA_TI_SRC_INC;          // Increment src addr
+    // Both channels shift out of the FIFO in parallel, 32 symbols per word
+    device->wire_ns = ((uint64_t)((device->pwm_words + device->reset_words) / device->pwm_channels) *
+                       32 * 1000000000ULL) / (ws2811->symbols * ws2811->freq);
+}
 
-    dma_cb->source_ad = addr_to_bus(device, device->pwm_raw);
+/**
+ * Setup the PWM controller in serial mode on both channels using DMA to feed the PWM FIFO.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static int setup_pwm(ws2811_t *ws2811)
+{
+    volatile dma_t *dma = ws2811->device->dma;
 
-    dma_cb->dest_ad = (uint32_t)&((pwm_t *)PWM_PERIPH_PHYS)->fif1;
-    dma_cb->txfr_len = byte_count;
-    dma_cb->stride = 0;
-    dma_cb->nextconbk = 0;
+    setup_clock(ws2811);
+    setup_pwm_ctl(ws2811);
+    setup_dma_cbs(ws2811);
 
     dma->cs = 0;
     dma->txfr_len = 0;
@@ -312,18 +627,16 @@ static int setup_pwm(ws2811_t *ws2811)
 }
 
 /**
- * Start the DMA feeding the PWM FIFO.  This will stream the entire DMA buffer out of both
- * PWM channels.
+ * Reset the DMA and start it on a chain of control blocks.
  *
- * @param    ws2811  ws2811 instance pointer.
+ * @param    ws2811       ws2811 instance pointer.
+ * @param    cb_addr      Bus address of the first control block.
  *
  * @returns  None
  */
-static void dma_start(ws2811_t *ws2811)
+static void dma_run(ws2811_t *ws2811, uint32_t cb_addr)
 {
-    ws2811_device_t *device = ws2811->device;
-    volatile dma_t *dma = device->dma;
-    uint32_t dma_cb_addr = device->dma_cb_addr;
+    volatile dma_t *dma = ws2811->device->dma;
 
     dma->cs = RPI_DMA_CS_RESET;
     usleep(10);
@@ -331,7 +644,7 @@ static void dma_start(ws2811_t *ws2811)
     dma->cs = RPI_DMA_CS_INT | RPI_DMA_CS_END;
     usleep(10);
 
-    dma->conblk_ad = dma_cb_addr;
+    dma->conblk_ad = cb_addr;
     dma->debug = 7; // clear debug error flags
     dma->cs = RPI_DMA_CS_WAIT_OUTSTANDING_WRITES |
               RPI_DMA_CS_PANIC_PRIORITY(15) | 
@@ -339,6 +652,116 @@ static void dma_start(ws2811_t *ws2811)
               RPI_DMA_CS_ACTIVE;
 }
 
+/**
+ * Start the DMA feeding the PWM FIFO.  This will stream the entire DMA buffer out of both
+ * PWM channels, followed by the reset signal.  The completion timer is armed for the end
+ * of the transfer.
+ *
+ * In free running mode each buffer's reset control block links back to its data block,
+ * so the DMA keeps repeating the buffer on its own.  If it's already repeating another
+ * buffer, that buffer's reset block is pointed at the new one instead of restarting the
+ * DMA.  The DMA loads the link along with the rest of the control block, so the switch
+ * happens within two passes and is complete once conblk_ad shows one of the new blocks.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    buf     Index of the DMA buffer to send.
+ *
+ * @returns  None
+ */
+static void dma_start(ws2811_t *ws2811, int buf)
+{
+    ws2811_device_t *device = ws2811->device;
+    volatile dma_t *dma = device->dma;
+    uint32_t dma_cb_addr = device->dma_cb_addr[buf];
+
+    TRACE_BEGIN("dma_start");
+
+    device->reset_cb[buf]->nextconbk = device->free_run ? dma_cb_addr : 0;
+
+    if (device->free_run && (dma->cs & RPI_DMA_CS_ACTIVE) && !(dma->cs & RPI_DMA_CS_ERROR))
+    {
+        // Make sure the buffer and its control blocks are in memory before linking to them
+        __sync_synchronize();
+        device->reset_cb[device->pwm_active]->nextconbk = dma_cb_addr;
+
+        device->pwm_active = buf;
+        device->dma_pending = -1;
+        device->dma_deadline = now_ns() + (device->wire_ns * 2);
+        timer_arm(ws2811, device->dma_deadline);
+
+        stats_frame_sent(ws2811);
+        TRACE_END("dma_start");
+
+        return;
+    }
+
+    dma_run(ws2811, dma_cb_addr);
+
+    device->pwm_active = buf;
+    device->dma_pending = -1;
+    device->dma_deadline = now_ns() + device->wire_ns;
+    timer_arm(ws2811, device->dma_deadline);
+
+    stats_frame_sent(ws2811);
+    TRACE_END("dma_start");
+}
+
+/**
+ * Check the DMA for a transfer error, and count it in the stats.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 if no error, -1 on DMA error
+ */
+static int dma_error(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    volatile dma_t *dma = device->dma;
+
+    if (dma->cs & RPI_DMA_CS_ERROR)
+    {
+        device->stats.dma_errors++;
+        device->stats.dma_debug = dma->debug;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Check if the DMA is still sending a buffer.  In free running mode the DMA never
+ * finishes, so this checks if it has yet to switch over to the last buffer started.
+ * A clip counts as busy until it's done, unless it loops.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  1 if a transfer is running, 0 otherwise.
+ */
+static int dma_busy(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    volatile dma_t *dma = device->dma;
+
+    if (!(dma->cs & RPI_DMA_CS_ACTIVE) || (dma->cs & RPI_DMA_CS_ERROR))
+    {
+        return 0;
+    }
+
+    // A looping clip never finishes, there's nothing to wait for
+    if (device->clip_playing)
+    {
+        return !device->clip_playing->loop;
+    }
+
+    if (device->free_run)
+    {
+        return (dma->conblk_ad != device->dma_cb_addr[device->pwm_active]) &&
+               (dma->conblk_ad != device->reset_cb_addr[device->pwm_active]);
+    }
+
+    return 1;
+}
+
 /**
  * Initialize the application selected GPIO pins for PWM operation.
  *
@@ -366,325 +789,1715 @@ static int gpio_init(ws2811_t *ws2811)
 
             gpio_function_set(gpio, pinnum, altnum);
         }
+
+        ws2811->device->gpionum[chan] = pinnum;
     }
 
     return 0;
 }
 
 /**
- * Initialize the PWM DMA buffer with all zeros, inverted operation will be
- * handled by hardware.  The DMA buffer length is assumed to be a word
- * multiple.
+ * Copy the encoded frame from the shadow buffer into the uncached DMA buffer.  The
+ * destination is only ever written whole words at a time and in ascending order,
+ * so the writes stream out over the bus rather than going through a read-modify-write
+ * per bit.
+ *
+ * Only the words that changed since this buffer was last filled are copied.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    buf     Index of the DMA buffer to fill, must not be in use by the DMA.
  *
  * @returns  None
  */
-void pwm_raw_init(ws2811_t *ws2811)
+static void pwm_raw_copy(ws2811_t *ws2811, int buf)
 {
-    volatile uint32_t *pwm_raw = (uint32_t *)ws2811->device->pwm_raw;
-    int maxcount = max_channel_led_count(ws2811);
-    int wordcount = (PWM_BYTE_COUNT(maxcount, ws2811->freq) / sizeof(uint32_t)) /
-                    RPI_PWM_CHANNELS;
-    int chan;
+    ws2811_device_t *device = ws2811->device;
+    volatile uint32_t *dst = (uint32_t *)device->pwm_raw[buf];
+    const uint32_t *src = device->pwm_shadow;
+    int words = device->pwm_dirty_hi[buf];
+    int i = device->pwm_dirty_lo[buf];
 
-    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    device->pwm_dirty_lo[buf] = device->pwm_words;
+    device->pwm_dirty_hi[buf] = 0;
+
+    // Four words at a time lets the compiler use multi-register loads and stores
+    for (; (i + 4) <= words; i += 4)
     {
-        int i, wordpos = chan;
+        uint32_t w0 = src[i + 0], w1 = src[i + 1], w2 = src[i + 2], w3 = src[i + 3];
 
-        for (i = 0; i < wordcount; i++)
-        {
-            pwm_raw[wordpos] = 0x0;
-            wordpos += 2;
-        }
+        dst[i + 0] = w0;
+        dst[i + 1] = w1;
+        dst[i + 2] = w2;
+        dst[i + 3] = w3;
+    }
+
+    for (; i < words; i++)
+    {
+        dst[i] = src[i];
     }
 }
 
 /**
- * Cleanup previously allocated device memory and buffers.
+ * Mark a range of words in the shadow buffer as changed, so it gets copied to every
+ * DMA buffer the next time that buffer is filled.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    lo      First changed word.
+ * @param    hi      One past the last changed word.
  *
  * @returns  None
  */
-void ws2811_cleanup(ws2811_t *ws2811)
+static void pwm_raw_dirty(ws2811_t *ws2811, int lo, int hi)
 {
     ws2811_device_t *device = ws2811->device;
-    int chan;
+    int buf;
 
-    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    for (buf = 0; buf < PWM_BUFFERS; buf++)
     {
-        if (ws2811->channel[chan].leds)
+        if (lo < device->pwm_dirty_lo[buf])
         {
-            free(ws2811->channel[chan].leds);
+            device->pwm_dirty_lo[buf] = lo;
         }
-        ws2811->channel[chan].leds = NULL;
+        if (hi > device->pwm_dirty_hi[buf])
+        {
+            device->pwm_dirty_hi[buf] = hi;
+        }
+    }
+}
+
+/**
+ * Encode a range of LEDs of every channel into a buffer with the device layout,
+ * using the encoder for the symbols per bit and number of channels in use.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    words   Buffer of pwm_words words to encode into.
+ * @param    first   First LED to encode.
+ * @param    count   Number of LEDs to encode.
+ *
+ * @returns  None
+ */
+static void encode_leds(ws2811_t *ws2811, uint32_t *words, int first, int count)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    if (device->pwm_channels == 1)
+    {
+        chan = device->pwm_channel;
+        if (ws2811->symbols == WS2811_SYMBOLS_ALIGNED)
+        {
+            encode_channel4(&ws2811->channel[chan], &device->lut[chan], words, first, count);
+        }
+        else
+        {
+            encode_channel(&ws2811->channel[chan], &device->lut[chan], words, 1, first, count);
+        }
+    }
+    else if (ws2811->symbols == WS2811_SYMBOLS_ALIGNED)
+    {
+        encode_channels4(ws2811->channel, device->lut, words, first, count);
+    }
+    else
+    {
+        encode_channels(ws2811->channel, device->lut, words, first, count);
+    }
+}
+
+/**
+ * Build a channel's color correction table for its current color settings, which
+ * also picks the encoder specialized for its strip type and brightness.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  None
+ */
+static void channel_settings_apply(ws2811_t *ws2811, int chan)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+
+    device->prev_brightness[chan] = channel->brightness;
+    device->prev_strip_type[chan] = channel->strip_type;
+    device->prev_gamma[chan] = channel->gamma;
+    device->prev_white_balance[chan] = channel->white_balance;
+
+    encode_lut_build(&device->lut[chan], channel->strip_type, channel->brightness,
+                     channel->gamma, channel->white_balance);
+}
+
+/**
+ * Check a channel's color settings against those of the last render, and rebuild
+ * its color correction table if any of them changed.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    chan    Channel number.
+ *
+ * @returns  1 if the settings changed, 0 otherwise.
+ */
+static int channel_settings_changed(ws2811_t *ws2811, int chan)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_channel_t *channel = &ws2811->channel[chan];
+
+    if ((channel->brightness == device->prev_brightness[chan]) &&
+        (channel->strip_type == device->prev_strip_type[chan]) &&
+        (channel->gamma == device->prev_gamma[chan]) &&
+        (channel->white_balance == device->prev_white_balance[chan]))
+    {
+        return 0;
+    }
+
+    channel_settings_apply(ws2811, chan);
+
+    return 1;
+}
+
+/**
+ * Check whether any channel has a changed LED in the block starting at the given LED.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    all     Per channel flag, set if every LED of that channel counts as changed.
+ * @param    first   First LED of the block.
+ *
+ * @returns  1 if the block changed, 0 otherwise.
+ */
+static int block_changed(ws2811_t *ws2811, const int *all, int first)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        int count = channel->count - first;
+
+        if (count <= 0)
+        {
+            continue;
+        }
+
+        if (count > DIRTY_BLOCK_LEDS)
+        {
+            count = DIRTY_BLOCK_LEDS;
+        }
+
+        if (all[chan] ||
+            memcmp(&channel->leds[first], &device->prev_leds[chan][first],
+                   sizeof(ws2811_led_t) * count))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Encode the LEDs that changed since the last render into the shadow buffer.  LEDs
+ * are compared against the previous frame a block at a time, and each run of blocks
+ * where either channel changed is encoded for both channels in a single pass.  A
+ * change of brightness, gamma, white balance or strip type, or a pending full
+ * render, rebuilds the color correction table and re-encodes the whole channel.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Number of LEDs encoded.
+ */
+static int render_leds(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int maxcount = max_channel_led_count(ws2811);
+    int all[RPI_PWM_CHANNELS];
+    int encoded = 0;
+    int i = 0, chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        all[chan] = channel_settings_changed(ws2811, chan) || device->render_all;
+    }
+
+    while (i < maxcount)
+    {
+        int start;
+
+        // Skip unchanged blocks
+        while ((i < maxcount) && !block_changed(ws2811, all, i))
+        {
+            i += DIRTY_BLOCK_LEDS;
+        }
+
+        // Extend the run over changed blocks
+        for (start = i; (i < maxcount) && block_changed(ws2811, all, i); i += DIRTY_BLOCK_LEDS)
+            ;
+
+        if (i > maxcount)
+        {
+            i = maxcount;
+        }
+
+        if (i <= start)
+        {
+            continue;
+        }
+
+        for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+        {
+            ws2811_channel_t *channel = &ws2811->channel[chan];
+            int end = (i < channel->count) ? i : channel->count;
+
+            if (end > start)
+            {
+                memcpy(&device->prev_leds[chan][start], &channel->leds[start],
+                       sizeof(ws2811_led_t) * (end - start));
+                encoded += end - start;
+            }
+        }
+
+        encode_leds(ws2811, device->pwm_shadow, start, i - start);
+
+        pwm_raw_dirty(ws2811, led_words(ws2811, start) * device->pwm_channels,
+                      led_words(ws2811, i) * device->pwm_channels);
+    }
+
+    return encoded;
+}
+
+/**
+ * Size the DMA layout for the current configuration, which PWM channels are used and
+ * how many words of LED data and reset signal each buffer sends.  Buffers only hold
+ * the LED data, the reset signal is sent from the zero source.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Bytes of mailbox memory needed, a whole number of pages.
+ */
+static unsigned layout_size(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    unsigned size;
+
+    pwm_channels_detect(ws2811);
+    device->pwm_words = led_words(ws2811, max_channel_led_count(ws2811)) * device->pwm_channels;
+    device->reset_words = RESET_WORDS(ws2811->freq, ws2811->symbols) * device->pwm_channels;
+
+    // Two control blocks and a frame per buffer, and the zero source
+    size = (((sizeof(dma_cb_t) * 2) + (device->pwm_words * sizeof(uint32_t))) * PWM_BUFFERS) +
+           RESET_SRC_BYTES;
+
+    // Round up to page size multiple
+    return (size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+}
+
+/**
+ * Allocate, lock and map a block of VideoCore memory through an open mailbox.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    mbox    Mailbox to allocate through, the handle must be open.
+ * @param    size    Bytes to allocate, a whole number of pages.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int mbox_alloc(ws2811_t *ws2811, videocore_mbox_t *mbox, unsigned size)
+{
+    mbox->size = size;
+    mbox->mem_ref = mem_alloc(mbox->handle, size, PAGE_SIZE,
+                              ws2811->rpi_hw->videocore_base == 0x40000000 ? 0xC : 0x4);
+    if (mbox->mem_ref == 0)
+    {
+        return -1;
+    }
+
+    mbox->bus_addr = mem_lock(mbox->handle, mbox->mem_ref);
+    if (mbox->bus_addr == (uint32_t) ~0UL)
+    {
+        mem_free(mbox->handle, mbox->mem_ref);
+        return -1;
+    }
+
+    mbox->virt_addr = mapmem(BUS_TO_PHYS(mbox->bus_addr), size);
+    if (!mbox->virt_addr)
+    {
+        mem_unlock(mbox->handle, mbox->mem_ref);
+        mem_free(mbox->handle, mbox->mem_ref);
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Unmap, unlock and free a block of VideoCore memory from mbox_alloc().  The mailbox
+ * itself stays open.
+ *
+ * @param    mbox    Mailbox the memory was allocated through.
+ *
+ * @returns  None
+ */
+static void mbox_release(videocore_mbox_t *mbox)
+{
+    unmapmem(mbox->virt_addr, mbox->size);
+    mem_unlock(mbox->handle, mbox->mem_ref);
+    mem_free(mbox->handle, mbox->mem_ref);
+}
+
+/**
+ * Place the control blocks, zero source and frame buffers in the mailbox memory.
+ * Control blocks go first to keep their alignment, followed by the zero source and
+ * the frame buffers.  Nothing is sent until the next render, which encodes every LED.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void layout_buffers(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint8_t *virt = device->mbox.virt_addr;
+    int i;
+
+    device->reset_src = (uint32_t *)((dma_cb_t *)virt + (PWM_BUFFERS * 2));
+    for (i = 0; i < (RESET_SRC_BYTES / sizeof(uint32_t)); i++)
+    {
+        device->reset_src[i] = 0;
+    }
+
+    for (i = 0; i < PWM_BUFFERS; i++)
+    {
+        device->dma_cb[i] = (dma_cb_t *)virt + (i * 2);
+        device->reset_cb[i] = (dma_cb_t *)virt + (i * 2) + 1;
+        device->pwm_raw[i] = (uint8_t *)device->reset_src + RESET_SRC_BYTES +
+                             (device->pwm_words * sizeof(uint32_t) * i);
+
+        memset((dma_cb_t *)device->dma_cb[i], 0, sizeof(dma_cb_t));
+        memset((dma_cb_t *)device->reset_cb[i], 0, sizeof(dma_cb_t));
+
+        // Cache the DMA control block bus addresses
+        device->dma_cb_addr[i] = addr_to_bus(device, device->dma_cb[i]);
+        device->reset_cb_addr[i] = addr_to_bus(device, device->reset_cb[i]);
+
+        // Each buffer is filled in full from the zeroed shadow the first time it's used,
+        // which also takes care of the idle words past the end of the shorter channel
+        device->pwm_dirty_lo[i] = 0;
+        device->pwm_dirty_hi[i] = device->pwm_words;
+    }
+
+    device->pwm_active = 0;
+    device->dma_pending = -1;
+
+    // The first frame is always encoded in full
+    device->render_all = 1;
+}
+
+/**
+ * Allocate the LED arrays for the channel LED counts.  Arrays that are already
+ * allocated are resized, keeping the LEDs still in range; new LEDs are cleared.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int leds_alloc(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811_channel_t *channel = &ws2811->channel[chan];
+        size_t size = sizeof(ws2811_led_t) * (channel->count ? channel->count : 1);
+        ws2811_led_t *leds;
+
+        leds = realloc(channel->leds, size);
+        if (!leds)
+        {
+            return -1;
+        }
+        channel->leds = leds;
+
+        if (channel->count > device->led_count[chan])
+        {
+            memset(&channel->leds[device->led_count[chan]], 0,
+                   sizeof(ws2811_led_t) * (channel->count - device->led_count[chan]));
+        }
+        device->led_count[chan] = channel->count;
+
+        // Copy of the last rendered frame, to find out what changed
+        leds = realloc(device->prev_leds[chan], size);
+        if (!leds)
+        {
+            return -1;
+        }
+        device->prev_leds[chan] = leds;
+
+        if (!channel->strip_type)
+        {
+          channel->strip_type=WS2811_STRIP_RGB;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Allocate the shadow buffer for the current layout, replacing any previous one.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+static int shadow_alloc(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (device->pwm_shadow)
+    {
+        free(device->pwm_shadow);
+    }
+
+    // Frames are encoded in normal cached memory and then copied to the DMA buffer
+    if (posix_memalign((void **)&device->pwm_shadow, SHADOW_ALIGN,
+                       device->pwm_words * sizeof(uint32_t)))
+    {
+        device->pwm_shadow = NULL;
+        return -1;
+    }
+    memset(device->pwm_shadow, 0, device->pwm_words * sizeof(uint32_t));
+
+    return 0;
+}
+
+/**
+ * Check the symbols per bit setting, filling in the default.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 if unsupported.
+ */
+static int symbols_check(ws2811_t *ws2811)
+{
+    if (!ws2811->symbols)
+    {
+        ws2811->symbols = WS2811_SYMBOLS;
+    }
+
+    if ((ws2811->symbols != WS2811_SYMBOLS) && (ws2811->symbols != WS2811_SYMBOLS_ALIGNED))
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+/**
+ * Cleanup previously allocated device memory and buffers.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+void ws2811_cleanup(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int chan;
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (ws2811->channel[chan].leds)
+        {
+            free(ws2811->channel[chan].leds);
+        }
+        ws2811->channel[chan].leds = NULL;
+
+        if (device->prev_leds[chan])
+        {
+            free(device->prev_leds[chan]);
+        }
+        device->prev_leds[chan] = NULL;
+    }
+
+    if (device->pwm_shadow)
+    {
+        free(device->pwm_shadow);
+    }
+    device->pwm_shadow = NULL;
+
+    if (device->timer_fd != -1)
+    {
+        close(device->timer_fd);
+    }
+    device->timer_fd = -1;
+
+    while (device->clips)
+    {
+        ws2811_clip_t *clip = device->clips;
+
+        device->clips = clip->next;
+        mbox_release(&clip->mbox);
+        free(clip);
+    }
+
+    if (device->mbox.handle != -1)
+    {
+        videocore_mbox_t *mbox = &device->mbox;
+
+        mbox_release(mbox);
+        mbox_close(mbox->handle);
+
+        mbox->handle = -1;
+    }
+
+    if (device) {
+        free(device);
+    }
+    ws2811->device = NULL;
+}
+
+
+/*
+ *
+ * Application API Functions
+ *
+ */
+
+
+/**
+ * Allocate and initialize memory, buffers, pages, PWM, DMA, and GPIO.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_init(ws2811_t *ws2811)
+{
+    ws2811_device_t *device;
+    int chan, i;
+
+    ws2811->rpi_hw = rpi_hw_detect();
+    if (!ws2811->rpi_hw)
+    {
+        return -1;
+    }
+
+    if (symbols_check(ws2811))
+    {
+        return -1;
+    }
+
+    // Pick the fastest symbol expansion kernel this CPU can run
+    encode_kernel_detect();
+
+    ws2811->device = malloc(sizeof(*ws2811->device));
+    if (!ws2811->device)
+    {
+        return -1;
+    }
+    device = ws2811->device;
+    device->timer_fd = -1;
+    device->clips = NULL;
+    device->clip_playing = NULL;
+    device->layout_id = 0;
+
+    device->mbox.handle = mbox_open();
+    if (device->mbox.handle == -1)
+    {
+        return -1;
+    }
+
+    // Determine how much physical memory we need for DMA
+    if (mbox_alloc(ws2811, &device->mbox, layout_size(ws2811)))
+    {
+        return -1;
+    }
+
+    // Initialize all pointers to NULL.  Any non-NULL pointers will be freed on cleanup.
+    for (i = 0; i < PWM_BUFFERS; i++)
+    {
+        device->pwm_raw[i] = NULL;
+        device->dma_cb[i] = NULL;
+        device->reset_cb[i] = NULL;
+    }
+    device->pwm_shadow = NULL;
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        ws2811->channel[chan].leds = NULL;
+        device->prev_leds[chan] = NULL;
+        device->led_count[chan] = 0;
+        device->gpionum[chan] = 0;
+    }
+
+    // Allocate the LED buffers
+    if (leds_alloc(ws2811))
+    {
+        goto err;
+    }
+
+    // Pick the encoders for the strip types
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        channel_settings_apply(ws2811, chan);
+    }
+
+    layout_buffers(ws2811);
+    device->dma_deadline = 0;
+    device->free_run = 0;
+    device->present_period_ns = 0;
+
+    if (shadow_alloc(ws2811))
+    {
+        goto err;
+    }
+
+    memset(&device->stats, 0, sizeof(device->stats));
+    device->fps_start = now_ns();
+    device->fps_frames = 0;
+
+    // Becomes readable when a transfer is expected to be done, for event loops
+    device->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (device->timer_fd == -1)
+    {
+        goto err;
+    }
+
+    // Map the physical registers into userspace
+    if (map_registers(ws2811))
+    {
+        goto err;
+    }
+
+    // Initialize the GPIO pins
+    if (gpio_init(ws2811))
+    {
+        unmap_registers(ws2811);
+        goto err;
+    }
+
+    // Setup the PWM, clocks, and DMA
+    if (setup_pwm(ws2811))
+    {
+        unmap_registers(ws2811);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    ws2811_cleanup(ws2811);
+
+    return -1;
+}
+
+/**
+ * Apply changes to the LED counts, strip types, frequency, symbols per bit, output
+ * inversion or GPIO pins of an initialized instance, without the teardown and
+ * blackout of ws2811_fini() and ws2811_init().  The register mappings, mailbox and
+ * clock stay as they are where possible:
+ *
+ *     - The mailbox memory is only reallocated if the new layout needs more of it.
+ *     - The PWM clock is only reprogrammed if the frequency or symbols per bit changed.
+ *     - The PWM control register is only rewritten if its value changed.
+ *     - Only pins that changed are switched, old ones go back to being inputs.
+ *
+ * LEDs still in range keep their color and the next render sends every LED.  A playing
+ * clip is stopped, and existing clips can only be freed afterwards.  On
+ * failure the instance is left as it was if possible; if the LED arrays or buffers
+ * could not be reallocated, it should be torn down with ws2811_fini().
+ *
+ * @param    ws2811  ws2811 instance pointer, with the new settings filled in.
+ *
+ * @returns  0 on success, -1 otherwise.
+ */
+int ws2811_reconfigure(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int free_run = device->free_run;
+    int pwm_channels = device->pwm_channels;
+    int pwm_channel = device->pwm_channel;
+    int pwm_words = device->pwm_words;
+    int reset_words = device->reset_words;
+    unsigned size;
+    int chan;
+
+    if (symbols_check(ws2811))
+    {
+        return -1;
+    }
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        int pinnum = ws2811->channel[chan].gpionum;
+
+        if (pinnum && (pwm_pin_alt(chan, pinnum) < 0))
+        {
+            return -1;
+        }
+    }
+
+    // Everything below changes what the DMA reads, let it finish first
+    if (ws2811_clip_stop(ws2811) || ws2811_set_free_run(ws2811, 0) || ws2811_wait(ws2811))
+    {
+        return -1;
+    }
+
+    size = layout_size(ws2811);
+    if (size > device->mbox.size)
+    {
+        videocore_mbox_t mbox = device->mbox;
+
+        // Allocate the new block before letting go of the old one, so the current
+        // layout stays usable if there isn't enough memory for the new one
+        if (mbox_alloc(ws2811, &mbox, size))
+        {
+            device->pwm_channels = pwm_channels;
+            device->pwm_channel = pwm_channel;
+            device->pwm_words = pwm_words;
+            device->reset_words = reset_words;
+            return -1;
+        }
+
+        mbox_release(&device->mbox);
+        device->mbox = mbox;
+    }
+
+    layout_buffers(ws2811);
+
+    if (leds_alloc(ws2811) || shadow_alloc(ws2811))
+    {
+        return -1;
+    }
+
+    // Pins that are no longer used go back to being inputs
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        if (device->gpionum[chan] && (device->gpionum[chan] != ws2811->channel[chan].gpionum))
+        {
+            gpio_output_set(device->gpio, device->gpionum[chan], 0);
+        }
+    }
+
+    if (gpio_init(ws2811))
+    {
+        return -1;
+    }
+
+    if ((ws2811->freq != device->clk_freq) || (ws2811->symbols != device->clk_symbols))
+    {
+        setup_clock(ws2811);
+    }
+
+    if (pwm_ctl_value(ws2811) != device->pwm_ctl)
+    {
+        setup_pwm_ctl(ws2811);
+    }
+
+    setup_dma_cbs(ws2811);
+
+    // Clips encoded for the old layout can't be played any more
+    device->layout_id++;
+    device->free_run = free_run;
+
+    return 0;
+}
+
+/**
+ * Shut down DMA, PWM, and cleanup memory.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+void ws2811_fini(ws2811_t *ws2811)
+{
+    ws2811_clip_stop(ws2811);
+    ws2811_wait(ws2811);
+    ws2811_set_free_run(ws2811, 0);
+    stop_pwm(ws2811);
+
+    unmap_registers(ws2811);
+
+    ws2811_cleanup(ws2811);
+}
+
+/**
+ * Bring the idle DMA buffer up to date with the shadow buffer.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void frame_copy(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_stats_t *stats = &device->stats;
+    uint64_t start;
+
+    TRACE_BEGIN("copy");
+    start = now_ns();
+
+    pwm_raw_copy(ws2811, device->pwm_active ^ 1);
+
+    stats->copy_ns = now_ns() - start;
+    TRACE_END("copy");
+    stats->copy_ns_total += stats->copy_ns;
+}
+
+/**
+ * Send the frame in the shadow buffer out of the idle DMA buffer, once the DMA is
+ * done with it.  In free running mode the idle buffer is repeated until the DMA
+ * switches away from it, so it's only filled now rather than while encoding.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  None
+ */
+static void frame_send(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (device->free_run)
+    {
+        frame_copy(ws2811);
+    }
+
+    dma_start(ws2811, device->pwm_active ^ 1);
+}
+
+/**
+ * Wait for the running DMA transfer to complete.  Sleeps until the transfer is
+ * expected to be done, rather than polling the DMA for the whole wire time.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+static int dma_wait(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_stats_t *stats = &device->stats;
+    uint64_t start;
+
+    TRACE_BEGIN("wait");
+    start = now_ns();
+
+    if (dma_busy(ws2811) && (start < device->dma_deadline))
+    {
+        sleep_until(device->dma_deadline);
+    }
+
+    while (dma_busy(ws2811))
+    {
+        usleep(10);
+    }
+
+    stats->wait_ns = now_ns() - start;
+    stats->wait_ns_total += stats->wait_ns;
+    stats_hist_add(stats->wait_hist, stats->wait_ns);
+    TRACE_END("wait");
+
+    return dma_error(ws2811);
+}
+
+/**
+ * Wait for any executing DMA operation to complete before returning.  A frame
+ * queued by ws2811_render_async() is sent and waited for as well.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_wait(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (dma_wait(ws2811))
+    {
+        return -1;
+    }
+
+    if (device->dma_pending != -1)
+    {
+        frame_send(ws2811);
+
+        return dma_wait(ws2811);
+    }
+
+    return 0;
+}
+
+/**
+ * Encode the LEDs that changed since the last render and, unless free running,
+ * bring the idle DMA buffer up to date with them while the previous frame is
+ * still going out of the other one.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  Number of LEDs encoded, 0 if nothing changed and the frame is skipped.
+ */
+static int render_frame(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_stats_t *stats = &device->stats;
+    int encoded;
+    uint64_t start;
+
+    TRACE_BEGIN("encode");
+    start = now_ns();
+
+    encoded = render_leds(ws2811);
+    device->render_all = 0;
+
+    stats->encode_ns = now_ns() - start;
+    TRACE_END("encode");
+    stats->encoded_leds = encoded;
+
+    if (!encoded)
+    {
+        // The LEDs already show this frame
+        stats->frames_skipped++;
+        return 0;
+    }
+
+    stats->encode_ns_total += stats->encode_ns;
+    stats->encoded_leds_total += encoded;
+    stats_hist_add(stats->encode_hist, stats->encode_ns);
+
+    if (!device->free_run)
+    {
+        frame_copy(ws2811);
+    }
+
+    return encoded;
+}
+
+/**
+ * Render the PWM DMA buffer from the user supplied LED arrays and start the DMA
+ * controller.  This will update all LEDs on both PWM channels.  Only LEDs that
+ * changed since the last render are encoded into the cached shadow buffer and then
+ * copied into whichever DMA buffer is idle, while the previous frame is still
+ * going out of the other one.  If nothing changed at all the frame is skipped
+ * and the DMA is left alone.  A playing clip is stopped at the end of its current frame.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_render(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    int ret = 0;
+
+    TRACE_BEGIN("render");
+
+    if (ws2811_clip_stop(ws2811))
+    {
+        ret = -1;
+        goto out;
+    }
+
+    if (!render_frame(ws2811))
+    {
+        goto out;
+    }
+
+    // Any frame queued by ws2811_render_async() is superseded by this one
+    device->dma_pending = -1;
+
+    // Wait for the previous frame to finish before switching buffers.
+    if (dma_wait(ws2811))
+    {
+        ret = -1;
+        goto out;
+    }
+
+    frame_send(ws2811);
+
+out:
+    TRACE_END("render");
+
+    return ret;
+}
+
+/**
+ * Render the LEDs like ws2811_render(), without blocking.  If the DMA is idle the
+ * frame is sent right away, otherwise it is queued and sent by ws2811_poll() once
+ * the running transfer completes.  A frame still queued from an earlier call is
+ * replaced, so the LEDs always catch up with the latest frame.
+ *
+ * Completion is reported through the descriptor from ws2811_get_fd().  A playing clip
+ * is stopped first, which blocks until the end of its current frame.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_render_async(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+
+    if (ws2811_clip_stop(ws2811))
+    {
+        return -1;
+    }
+
+    if (!render_frame(ws2811))
+    {
+        return 0;
+    }
+
+    if (dma_error(ws2811))
+    {
+        return -1;
+    }
+
+    if (dma_busy(ws2811))
+    {
+        device->dma_pending = device->pwm_active ^ 1;
+        return 0;
+    }
+
+    frame_send(ws2811);
+
+    return 0;
+}
+
+/**
+ * Finish asynchronous rendering work, to be called when the descriptor from
+ * ws2811_get_fd() becomes readable.  Starts a queued frame once the running
+ * transfer is done, and re-arms the descriptor as long as there is a transfer
+ * left to wait for.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 when all frames are out, 1 while a transfer is still running, -1 on DMA
+ *           completion error
+ */
+int ws2811_poll(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint64_t expirations;
+
+    // Consume the expiration, it's re-armed below if there's more to wait for
+    if ((read(device->timer_fd, &expirations, sizeof(expirations)) < 0) &&
+        (errno != EAGAIN))
+    {
+        return -1;
+    }
+
+    if (dma_error(ws2811))
+    {
+        return -1;
+    }
+
+    if (dma_busy(ws2811))
+    {
+        // Running late, check back shortly
+        timer_arm(ws2811, now_ns() + DMA_RECHECK_NS);
+        return 1;
+    }
+
+    if (device->dma_pending != -1)
+    {
+        frame_send(ws2811);
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Get a descriptor that becomes readable when the running transfer is expected to
+ * be done, for use with poll(), select() or epoll.  Call ws2811_poll() when it does.
+ * The descriptor is owned by the driver and closed by ws2811_fini().
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  File descriptor.
+ */
+int ws2811_get_fd(ws2811_t *ws2811)
+{
+    return ws2811->device->timer_fd;
+}
+
+/**
+ * Switch free running mode on or off.  While it's on, the DMA repeats the last frame
+ * without any CPU involvement, keeping the LEDs refreshed, and each render links the
+ * new frame in place of the old one at the end of a pass rather than restarting the
+ * DMA.  ws2811_wait() then returns once the new frame is the one being repeated.
+ * Turning it on repeats the frame already shown, if any; turning it off lets the DMA
+ * finish the frame and stop.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    enable  1 to turn free running mode on, 0 to turn it off.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_set_free_run(ws2811_t *ws2811, int enable)
+{
+    ws2811_device_t *device = ws2811->device;
+    int buf;
+
+    if (ws2811_clip_stop(ws2811))
+    {
+        return -1;
     }
 
-    if (device->mbox.handle != -1)
+    enable = !!enable;
+    if (enable == device->free_run)
     {
-        videocore_mbox_t *mbox = &device->mbox;
+        return 0;
+    }
 
-        unmapmem(mbox->virt_addr, mbox->size);
-        mem_unlock(mbox->handle, mbox->mem_ref);
-        mem_free(mbox->handle, mbox->mem_ref);
-        mbox_close(mbox->handle);
+    if (ws2811_wait(ws2811))
+    {
+        return -1;
+    }
 
-        mbox->handle = -1;
+    device->free_run = enable;
+
+    if (enable)
+    {
+        if (device->stats.frames)
+        {
+            dma_start(ws2811, device->pwm_active);
+        }
+
+        return 0;
     }
 
-    if (device) {
-        free(device);
+    // Break the loop, the DMA may already have loaded the old link for one more pass
+    for (buf = 0; buf < PWM_BUFFERS; buf++)
+    {
+        device->reset_cb[buf]->nextconbk = 0;
     }
-    ws2811->device = NULL;
-}
+    device->dma_deadline = now_ns() + (device->wire_ns * 2);
 
+    return dma_wait(ws2811);
+}
 
-/*
+/**
+ * Get the highest frame rate the LEDs can be refreshed at, limited by the time it
+ * takes to send a frame, including the reset gap, over the longest channel.
  *
- * Application API Functions
+ * @param    ws2811  ws2811 instance pointer.
  *
+ * @returns  Frames per second.
  */
-
+int ws2811_max_fps(ws2811_t *ws2811)
+{
+    return 1000000000ULL / ws2811->device->wire_ns;
+}
 
 /**
- * Allocate and initialize memory, buffers, pages, PWM, DMA, and GPIO.
+ * Set the rate ws2811_present() shows frames at, and start a new schedule.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    fps     Frames per second, 0 to render right away without pacing.
  *
- * @returns  0 on success, -1 otherwise.
+ * @returns  0 on success, -1 if the rate is above ws2811_max_fps()
  */
-int ws2811_init(ws2811_t *ws2811)
+int ws2811_set_fps(ws2811_t *ws2811, int fps)
 {
-    ws2811_device_t *device;
-    const rpi_hw_t *rpi_hw;
-    int chan;
+    ws2811_device_t *device = ws2811->device;
 
-    ws2811->rpi_hw = rpi_hw_detect();
-    if (!ws2811->rpi_hw)
+    if ((fps < 0) || (fps > ws2811_max_fps(ws2811)))
     {
         return -1;
     }
-    rpi_hw = ws2811->rpi_hw;
 
-    ws2811->device = malloc(sizeof(*ws2811->device));
-    if (!ws2811->device)
-    {
-        return -1;
-    }
-    device = ws2811->device;
+    device->present_period_ns = fps ? (1000000000ULL / fps) : 0;
+    device->present_deadline = 0;
+    device->present_count = 0;
+    device->stats.present_fps = 0;
 
-    // Determine how much physical memory we need for DMA
-    device->mbox.size = PWM_BYTE_COUNT(max_channel_led_count(ws2811), ws2811->freq) +
-                        sizeof(dma_cb_t);
-    // Round up to page size multiple
-    device->mbox.size = (device->mbox.size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+    return 0;
+}
 
-    device->mbox.handle = mbox_open();
-    if (device->mbox.handle == -1)
+/**
+ * Render the LEDs at the rate set with ws2811_set_fps().  Sleeps until the frame is
+ * due and then renders it like ws2811_render().  Deadlines are absolute, so the time
+ * spent building and rendering a frame doesn't add up into drift.  A frame that
+ * comes in after its deadline is rendered right away and counted as missed; if it
+ * is a whole period late the schedule restarts from now rather than bursting to
+ * catch up.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA competion error
+ */
+int ws2811_present(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_stats_t *stats = &device->stats;
+    uint64_t now = now_ns();
+
+    if (!device->present_period_ns)
     {
-        return -1;
+        return ws2811_render(ws2811);
     }
 
-    device->mbox.mem_ref = mem_alloc(device->mbox.handle, device->mbox.size, PAGE_SIZE,
-                                     rpi_hw->videocore_base == 0x40000000 ? 0xC : 0x4);
-    if (device->mbox.mem_ref == 0)
+    if (!device->present_deadline)
     {
-       return -1;
+        device->present_deadline = now;
+        device->present_start = now;
+        device->present_count = 0;
     }
+    else if (now > device->present_deadline)
+    {
+        stats->deadlines_missed++;
 
-    device->mbox.bus_addr = mem_lock(device->mbox.handle, device->mbox.mem_ref);
-    if (device->mbox.bus_addr == (uint32_t) ~0UL)
+        if ((now - device->present_deadline) >= device->present_period_ns)
+        {
+            device->present_deadline = now;
+            device->present_start = now;
+            device->present_count = 0;
+        }
+    }
+    else
     {
-       mem_free(device->mbox.handle, device->mbox.size);
-       return -1;
+        sleep_until(device->present_deadline);
     }
-    device->mbox.virt_addr = mapmem(BUS_TO_PHYS(device->mbox.bus_addr), device->mbox.size);
 
-    // Initialize all pointers to NULL.  Any non-NULL pointers will be freed on cleanup.
-    device->pwm_raw = NULL;
-    device->dma_cb = NULL;
-    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    now = now_ns();
+    if (device->present_count)
     {
-        ws2811->channel[chan].leds = NULL;
+        stats->present_fps = (device->present_count * 1000000000.0) /
+                             (now - device->present_start);
     }
+    device->present_count++;
+    device->present_deadline += device->present_period_ns;
 
-    // Allocate the LED buffers
-    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    return ws2811_render(ws2811);
+}
+
+/**
+ * Get the bus address of a location in a clip's mailbox memory.
+ *
+ * @param    clip    Clip the location belongs to.
+ * @param    virt    Userspace address in the clip's memory.
+ *
+ * @returns  Bus address for use by DMA.
+ */
+static uint32_t clip_bus(ws2811_clip_t *clip, const volatile void *virt)
+{
+    return clip->mbox.bus_addr + ((uint8_t *)virt - clip->mbox.virt_addr);
+}
+
+/**
+ * Link the frames of a clip in order, and the last back to the first when looping.
+ *
+ * @param    clip    Clip to link.
+ * @param    loop    1 to play the clip over and over, 0 to play it once.
+ *
+ * @returns  None
+ */
+static void clip_link(ws2811_clip_t *clip, int loop)
+{
+    int frame;
+
+    for (frame = 0; frame < clip->frames; frame++)
     {
-        ws2811_channel_t *channel = &ws2811->channel[chan];
+        volatile dma_cb_t *last = &clip->cb[((frame + 1) * clip->frame_cbs) - 1];
+        int next = frame + 1;
 
-        channel->leds = malloc(sizeof(ws2811_led_t) * channel->count);
-        if (!channel->leds)
+        if (next == clip->frames)
         {
-            goto err;
+            next = loop ? 0 : -1;
         }
 
-        memset(channel->leds, 0, sizeof(ws2811_led_t) * channel->count);
+        last->nextconbk = (next < 0) ? 0 : clip_bus(clip, &clip->cb[next * clip->frame_cbs]);
+    }
+}
+
+/**
+ * Fill in a run of control blocks that send data to the PWM FIFO, split up so no
+ * block moves more than CLIP_CB_MAX_BYTES.
+ *
+ * @param    clip    Clip the control blocks belong to.
+ * @param    cb      First control block, followed by the rest of the run.
+ * @param    src     Bus address of the data.
+ * @param    inc     1 to step through the data, 0 to send the same word over and over.
+ * @param    bytes   Bytes to send.
+ * @param    next    Bus address of the control block after the run, or 0.
+ *
+ * @returns  None
+ */
+static void clip_cbs_fill(ws2811_clip_t *clip, volatile dma_cb_t *cb, uint32_t src, int inc,
+                          int bytes, uint32_t next)
+{
+    int count = CLIP_CBS(bytes);
+    int i;
 
-        if (!channel->strip_type)
+    for (i = 0; i < count; i++)
+    {
+        cb[i].ti = RPI_DMA_TI_NO_WIDE_BURSTS |    // 32-bit transfers
+                   RPI_DMA_TI_WAIT_RESP |         // wait for write complete
+                   RPI_DMA_TI_DEST_DREQ |         // user peripheral flow control
+                   RPI_DMA_TI_PERMAP(5) |         // PWM peripheral
+                   (inc ? RPI_DMA_TI_SRC_INC : 0);
+        cb[i].source_ad = src;
+        cb[i].dest_ad = (uint32_t)&((pwm_t *)PWM_PERIPH_PHYS)->fif1;
+        cb[i].txfr_len = (bytes > CLIP_CB_MAX_BYTES) ? CLIP_CB_MAX_BYTES : bytes;
+        cb[i].nextconbk = (i < (count - 1)) ? clip_bus(clip, &cb[i + 1]) : next;
+
+        if (inc)
         {
-          channel->strip_type=WS2811_STRIP_RGB;
+            src += cb[i].txfr_len;
         }
+        bytes -= cb[i].txfr_len;
     }
+}
 
-    device->dma_cb = (dma_cb_t *)device->mbox.virt_addr;
-    device->pwm_raw = (uint8_t *)device->mbox.virt_addr + sizeof(dma_cb_t);
+/**
+ * Create a clip of pre-encoded frames for the DMA to play back on its own at a fixed
+ * rate, for canned animations that would otherwise be encoded over and over again.
+ * The frames are held in DMA memory and filled with ws2811_clip_capture().  Each one
+ * is followed by a reset gap stretched to the frame period, so the rate comes from the
+ * PWM clock and takes no CPU time at all.
+ *
+ * The clip is tied to the current LED counts, frequency and symbols per bit, and all
+ * clips together can use at most .clip_mem_max bytes, reported in the stats.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    frames  Number of frames.
+ * @param    fps     Playback rate, at most ws2811_max_fps().
+ *
+ * @returns  Clip, or NULL if out of memory or over the limit, or the rate is too high.
+ */
+ws2811_clip_t *ws2811_clip_create(ws2811_t *ws2811, int frames, int fps)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint32_t limit = ws2811->clip_mem_max ? ws2811->clip_mem_max : WS2811_CLIP_MEM_DEFAULT;
+    ws2811_clip_t *clip;
+    uint64_t period_words;
+    int gap_words, data_cbs, gap_cbs, frame;
+    unsigned size;
 
-    pwm_raw_init(ws2811);
+    if ((frames <= 0) || (fps <= 0))
+    {
+        return NULL;
+    }
 
-    memset((dma_cb_t *)device->dma_cb, 0, sizeof(dma_cb_t));
+    // Wire time of one frame period, in words of all channels
+    period_words = (((uint64_t)ws2811->symbols * ws2811->freq) / (32 * fps)) * device->pwm_channels;
+    if (period_words < (device->pwm_words + device->reset_words))
+    {
+        return NULL;
+    }
 
-    // Cache the DMA control block bus address
-    device->dma_cb_addr = addr_to_bus(device, device->dma_cb);
+    gap_words = period_words - device->pwm_words;
+    data_cbs = CLIP_CBS(device->pwm_words * sizeof(uint32_t));
+    gap_cbs = CLIP_CBS(gap_words * sizeof(uint32_t));
 
-    // Map the physical registers into userspace
-    if (map_registers(ws2811))
+    size = (((data_cbs + gap_cbs) * sizeof(dma_cb_t)) + (device->pwm_words * sizeof(uint32_t))) *
+           frames;
+    size = (size + (PAGE_SIZE - 1)) & ~(PAGE_SIZE - 1);
+
+    if (((uint64_t)device->stats.clip_bytes + size) > limit)
     {
-        goto err;
+        return NULL;
     }
 
-    // Initialize the GPIO pins
-    if (gpio_init(ws2811))
+    clip = malloc(sizeof(*clip));
+    if (!clip)
     {
-        unmap_registers(ws2811);
-        goto err;
+        return NULL;
     }
 
-    // Setup the PWM, clocks, and DMA
-    if (setup_pwm(ws2811))
+    clip->mbox.handle = device->mbox.handle;
+    if (mbox_alloc(ws2811, &clip->mbox, size))
     {
-        unmap_registers(ws2811);
-        goto err;
+        free(clip);
+        return NULL;
     }
 
-    return 0;
+    clip->frames = frames;
+    clip->frame_cbs = data_cbs + gap_cbs;
+    clip->cb = (dma_cb_t *)clip->mbox.virt_addr;
+    clip->data = (uint32_t *)&clip->cb[frames * clip->frame_cbs];
+    clip->layout_id = device->layout_id;
+    clip->period_ns = ((period_words / device->pwm_channels) * 32 * 1000000000ULL) /
+                      (ws2811->symbols * ws2811->freq);
+    clip->loop = 0;
 
-err:
-    ws2811_cleanup(ws2811);
+    memset(clip->mbox.virt_addr, 0, size);
 
-    return -1;
+    for (frame = 0; frame < frames; frame++)
+    {
+        volatile dma_cb_t *cb = &clip->cb[frame * clip->frame_cbs];
+
+        // The frame's data, then the reset gap stretching it to the period
+        clip_cbs_fill(clip, cb, clip_bus(clip, &clip->data[frame * device->pwm_words]), 1,
+                      device->pwm_words * sizeof(uint32_t), clip_bus(clip, &cb[data_cbs]));
+        clip_cbs_fill(clip, &cb[data_cbs], addr_to_bus(device, device->reset_src), 0,
+                      gap_words * sizeof(uint32_t), 0);
+    }
+
+    clip->next = device->clips;
+    device->clips = clip;
+    device->stats.clip_bytes += size;
+
+    return clip;
 }
 
 /**
- * Shut down DMA, PWM, and cleanup memory.
+ * Encode the current LEDs into a frame of a clip, with the same color correction as
+ * ws2811_render().  The LEDs themselves are left alone.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    clip    Clip from ws2811_clip_create(), not playing.
+ * @param    frame   Frame number to fill in.
  *
- * @returns  None
+ * @returns  0 on success, -1 otherwise.
  */
-void ws2811_fini(ws2811_t *ws2811)
+int ws2811_clip_capture(ws2811_t *ws2811, ws2811_clip_t *clip, int frame)
 {
-    ws2811_wait(ws2811);
-    stop_pwm(ws2811);
+    ws2811_device_t *device = ws2811->device;
+    volatile uint32_t *dst;
+    uint32_t *words;
+    int chan, i;
 
-    unmap_registers(ws2811);
+    if ((clip->layout_id != device->layout_id) || (clip == device->clip_playing) ||
+        (frame < 0) || (frame >= clip->frames))
+    {
+        return -1;
+    }
 
-    ws2811_cleanup(ws2811);
+    if (posix_memalign((void **)&words, SHADOW_ALIGN, device->pwm_words * sizeof(uint32_t)))
+    {
+        return -1;
+    }
+    memset(words, 0, device->pwm_words * sizeof(uint32_t));
+
+    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)
+    {
+        // The last rendered frame was encoded with the old settings
+        if (channel_settings_changed(ws2811, chan))
+        {
+            device->render_all = 1;
+        }
+    }
+
+    encode_leds(ws2811, words, 0, max_channel_led_count(ws2811));
+
+    dst = &clip->data[frame * device->pwm_words];
+    for (i = 0; i < device->pwm_words; i++)
+    {
+        dst[i] = words[i];
+    }
+
+    free(words);
+
+    return 0;
 }
 
 /**
- * Wait for any executing DMA operation to complete before returning.
+ * Start playing a clip, from the first frame.  The DMA steps through the frames on
+ * its own, and stops on the last one unless looping.  Free running mode is turned
+ * off, and rendering stops the clip.  ws2811_wait() waits for a clip to finish,
+ * unless it loops.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    clip    Clip to play, with every frame captured.
+ * @param    loop    1 to play the clip over and over, 0 to play it once.
  *
- * @returns  0 on success, -1 on DMA competion error
+ * @returns  0 on success, -1 if the clip is for an old layout, or on DMA error.
  */
-int ws2811_wait(ws2811_t *ws2811)
+int ws2811_clip_play(ws2811_t *ws2811, ws2811_clip_t *clip, int loop)
 {
-    volatile dma_t *dma = ws2811->device->dma;
+    ws2811_device_t *device = ws2811->device;
 
-    while ((dma->cs & RPI_DMA_CS_ACTIVE) &&
-           !(dma->cs & RPI_DMA_CS_ERROR))
+    if (clip->layout_id != device->layout_id)
     {
-        usleep(10);
+        return -1;
     }
 
-    if (dma->cs & RPI_DMA_CS_ERROR)
+    if (ws2811_set_free_run(ws2811, 0) || ws2811_wait(ws2811))
     {
-        fprintf(stderr, "DMA Error: %08x\n", dma->debug);
         return -1;
     }
 
+    clip_link(clip, loop);
+    clip->loop = loop;
+
+    // Make sure the frames and control blocks are in memory before the DMA reads them
+    __sync_synchronize();
+    dma_run(ws2811, clip_bus(clip, clip->cb));
+
+    device->clip_playing = clip;
+    device->dma_deadline = now_ns() + (clip->period_ns * clip->frames);
+    if (!loop)
+    {
+        timer_arm(ws2811, device->dma_deadline);
+    }
+
+    // The next render has to replace whatever frame the clip stops on
+    device->render_all = 1;
+
     return 0;
 }
 
 /**
- * Render the PWM DMA buffer from the user supplied LED arrays and start the DMA
- * controller.  This will update all LEDs on both PWM channels.
+ * Stop a playing clip at the end of the frame it's on, and wait for that.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ *
+ * @returns  0 on success, -1 on DMA error
+ */
+int ws2811_clip_stop(ws2811_t *ws2811)
+{
+    ws2811_device_t *device = ws2811->device;
+    ws2811_clip_t *clip = device->clip_playing;
+    int frame, ret;
+
+    if (!clip)
+    {
+        return 0;
+    }
+
+    for (frame = 0; frame < clip->frames; frame++)
+    {
+        clip->cb[((frame + 1) * clip->frame_cbs) - 1].nextconbk = 0;
+    }
+    clip->loop = 0;
+
+    // The DMA may already have loaded the link to the next frame
+    device->dma_deadline = now_ns() + (clip->period_ns * 2);
+    ret = dma_wait(ws2811);
+
+    device->clip_playing = NULL;
+
+    return ret;
+}
+
+/**
+ * Free a clip and its DMA memory, stopping it first if it's playing.
  *
  * @param    ws2811  ws2811 instance pointer.
+ * @param    clip    Clip from ws2811_clip_create().
  *
  * @returns  None
  */
-int ws2811_render(ws2811_t *ws2811)
+void ws2811_clip_free(ws2811_t *ws2811, ws2811_clip_t *clip)
 {
-    volatile uint8_t *pwm_raw = ws2811->device->pwm_raw;
-    int bitpos = 31;
-    int i, k, l, chan;
-    unsigned j;
+    ws2811_device_t *device = ws2811->device;
+    ws2811_clip_t **prev;
 
-    for (chan = 0; chan < RPI_PWM_CHANNELS; chan++)         // Channel
+    if (clip == device->clip_playing)
     {
-        ws2811_channel_t *channel = &ws2811->channel[chan];
-        int wordpos = chan;
-        int scale   = (channel->brightness & 0xff) + 1;
-        int rshift  = (channel->strip_type >> 16) & 0xff;
-        int gshift  = (channel->strip_type >> 8)  & 0xff;
-        int bshift  = (channel->strip_type >> 0)  & 0xff;
+        ws2811_clip_stop(ws2811);
+    }
 
-        for (i = 0; i < channel->count; i++)                // Led
+    for (prev = &device->clips; *prev; prev = &(*prev)->next)
+    {
+        if (*prev == clip)
         {
-            uint8_t color[] =
-            {
-                (((channel->leds[i] >> rshift) & 0xff) * scale) >> 8, // red
-                (((channel->leds[i] >> gshift) & 0xff) * scale) >> 8, // green
-                (((channel->leds[i] >> bshift) & 0xff) * scale) >> 8, // blue
-            };
-
-            for (j = 0; j < ARRAY_SIZE(color); j++)        // Color
-            {
-                for (k = 7; k >= 0; k--)                   // Bit
-                {
-                    uint8_t symbol = SYMBOL_LOW;
-
-                    if (color[j] & (1 << k))
-                    {
-                        symbol = SYMBOL_HIGH;
-                    }
-
-                    for (l = 2; l >= 0; l--)               // Symbol
-                    {
-                        uint32_t *wordptr = &((uint32_t *)pwm_raw)[wordpos];
-
-                        *wordptr &= ~(1 << bitpos);
-                        if (symbol & (1 << l))
-                        {
-                            *wordptr |= (1 << bitpos);
-                        }
-
-                        bitpos--;
-                        if (bitpos < 0)
-                        {
-                            // Every other word is on the same channel
-                            wordpos += 2;
-
-                            bitpos = 31;
-                        }
-                    }
-                }
-            }
+            *prev = clip->next;
+            break;
         }
     }
 
-    // Wait for any previous DMA operation to complete.
-    if (ws2811_wait(ws2811))
+    device->stats.clip_bytes -= clip->mbox.size;
+    mbox_release(&clip->mbox);
+    free(clip);
+}
+
+/**
+ * Return a snapshot of the render counters.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    stats   Filled in with the current counters.
+ *
+ * @returns  None
+ */
+void ws2811_get_stats(ws2811_t *ws2811, ws2811_stats_t *stats)
+{
+    ws2811_device_t *device = ws2811->device;
+    uint64_t now = now_ns();
+
+    *stats = device->stats;
+
+    // Rendering stopped or slowed down, let the rate show it before the next frame
+    if ((now - device->fps_start) >= 1000000000ULL)
+    {
+        stats->fps = (device->fps_frames * 1000000000.0) / (now - device->fps_start);
+    }
+
+    stats->max_fps = 1000000000.0 / device->wire_ns;
+}
+
+/**
+ * Append a histogram to a JSON line as an array.
+ *
+ * @param    buf     Line buffer.
+ * @param    size    Size of the buffer.
+ * @param    len     Length of the line so far.
+ * @param    name    Key.
+ * @param    hist    Histogram, WS2811_STATS_BUCKETS entries.
+ *
+ * @returns  New length, which may be beyond the buffer if it didn't fit.
+ */
+static int stats_hist_format(char *buf, int size, int len, const char *name,
+                             const uint32_t *hist)
+{
+    int i;
+
+    len += snprintf(buf + len, (len < size) ? (size - len) : 0, ",\"%s\":[", name);
+    for (i = 0; i < WS2811_STATS_BUCKETS; i++)
+    {
+        len += snprintf(buf + len, (len < size) ? (size - len) : 0, "%s%u",
+                        i ? "," : "", hist[i]);
+    }
+    len += snprintf(buf + len, (len < size) ? (size - len) : 0, "]");
+
+    return len;
+}
+
+/**
+ * Write the render counters to a file or socket as one line of JSON, for monitoring.
+ * The line goes out in a single write, so it makes up one datagram on a UDP or unix
+ * datagram socket.  Histogram bucket i counts times below 2^i microseconds.
+ *
+ * @param    ws2811  ws2811 instance pointer.
+ * @param    fd      File descriptor to write to.
+ *
+ * @returns  0 on success, -1 on write error
+ */
+int ws2811_stats_export(ws2811_t *ws2811, int fd)
+{
+    ws2811_stats_t stats;
+    char buf[1024];
+    int len;
+
+    ws2811_get_stats(ws2811, &stats);
+
+    len = snprintf(buf, sizeof(buf),
+                   "{\"frames\":%llu,\"frames_skipped\":%llu,\"fps\":%.1f,\"max_fps\":%.1f,"
+                   "\"present_fps\":%.1f,\"deadlines_missed\":%llu,"
+                   "\"encode_ns\":%u,\"encode_ns_total\":%llu,\"copy_ns\":%u,"
+                   "\"copy_ns_total\":%llu,\"wait_ns\":%u,\"wait_ns_total\":%llu,"
+                   "\"encoded_leds\":%u,\"encoded_leds_total\":%llu,"
+                   "\"dma_errors\":%llu,\"dma_debug\":%u,\"clip_bytes\":%u",
+                   (unsigned long long)stats.frames, (unsigned long long)stats.frames_skipped,
+                   stats.fps, stats.max_fps, stats.present_fps,
+                   (unsigned long long)stats.deadlines_missed,
+                   stats.encode_ns, (unsigned long long)stats.encode_ns_total,
+                   stats.copy_ns, (unsigned long long)stats.copy_ns_total,
+                   stats.wait_ns, (unsigned long long)stats.wait_ns_total,
+                   stats.encoded_leds, (unsigned long long)stats.encoded_leds_total,
+                   (unsigned long long)stats.dma_errors, stats.dma_debug, stats.clip_bytes);
+    len = stats_hist_format(buf, sizeof(buf), len, "encode_hist", stats.encode_hist);
+    len = stats_hist_format(buf, sizeof(buf), len, "wait_hist", stats.wait_hist);
+    len += snprintf(buf + len, (len < sizeof(buf)) ? (sizeof(buf) - len) : 0, "}\n");
+
+    if (len >= sizeof(buf))
     {
         return -1;
     }
 
-    dma_start(ws2811);
+    if (write(fd, buf, len) != len)
+    {
+        return -1;
+    }
 
     return 0;
 }
-
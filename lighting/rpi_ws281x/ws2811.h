@@ -41,6 +41,14 @@ extern "C" {
 
 #define WS2811_TARGET_FREQ                       800000   // Can go as low as 400000
 
+#define WS2811_SYMBOLS                           3        // PWM symbols per data bit, the default
+#define WS2811_SYMBOLS_ALIGNED                   4        // One word per color byte, simpler to encode
+
+#define WS2811_CLIP_MEM_DEFAULT                  (8 * 1024 * 1024)  // DMA memory for clips
+
+#define WS2811_STATS_BUCKETS                     20       // Histogram bucket i counts times
+                                                          // below 2^i us, down from 2^(i-1)
+
 #define WS2811_STRIP_RGB                         0x100800
 #define WS2811_STRIP_RBG                         0x100008
 #define WS2811_STRIP_GRB                         0x081000
@@ -49,6 +57,9 @@ extern "C" {
 #define WS2811_STRIP_BGR                         0x000810
 
 struct ws2811_device;
+struct ws2811_clip;
+
+typedef struct ws2811_clip ws2811_clip_t;        //< Pre-encoded frames, see ws2811_clip_create
 
 typedef uint32_t ws2811_led_t;                   //< 0x00RRGGBB
 typedef struct
@@ -58,23 +69,65 @@ typedef struct
     int count;                                   //< Number of LEDs, 0 if channel is unused
     int brightness;                              //< Brightness value between 0 and 255
     int strip_type;                              //< Strip color layout -- one of WS2811_STRIP_xxx constants
+    float gamma;                                 //< Gamma correction exponent, 0 for none
+    uint32_t white_balance;                      //< Per color gain as 0x00RRGGBB, 0 for none
     ws2811_led_t *leds;                          //< LED buffers, allocated by driver based on count
 } ws2811_channel_t;
 
+typedef struct
+{
+    uint64_t frames;                             //< Frames sent to the hardware
+    uint32_t encode_ns;                          //< Time to encode the last frame
+    uint32_t copy_ns;                            //< Time to copy the last frame into DMA memory
+    uint64_t encode_ns_total;                    //< Sum of encode_ns over all frames
+    uint64_t copy_ns_total;                      //< Sum of copy_ns over all frames
+    uint32_t encoded_leds;                       //< LEDs that changed and were encoded in the last frame
+    uint64_t encoded_leds_total;                 //< Sum of encoded_leds over all frames
+    uint64_t frames_skipped;                     //< Renders skipped because no LED changed
+    uint64_t deadlines_missed;                   //< Frames ws2811_present() got after their deadline
+    float present_fps;                           //< Rate ws2811_present() achieved on its schedule
+    uint32_t clip_bytes;                         //< DMA memory held by clips
+    uint32_t wait_ns;                            //< Time the last render or wait spent on the DMA
+    uint64_t wait_ns_total;                      //< Sum of wait_ns over all waits
+    uint32_t encode_hist[WS2811_STATS_BUCKETS];  //< Frames encoded, by encode_ns
+    uint32_t wait_hist[WS2811_STATS_BUCKETS];    //< Waits for the DMA, by wait_ns
+    uint64_t dma_errors;                         //< Renders and waits that failed on a DMA error
+    uint32_t dma_debug;                          //< DMA debug register as of the last error
+    float fps;                                   //< Frames sent per second, over the last second
+    float max_fps;                               //< Highest rate the LED count allows
+} ws2811_stats_t;
+
 typedef struct
 {
     struct ws2811_device *device;                //< Private data for driver use
     const rpi_hw_t *rpi_hw;                      //< RPI Hardware Information
     uint32_t freq;                               //< Required output frequency
     int dmanum;                                  //< DMA number _not_ already in use
+    int symbols;                                 //< PWM symbols per data bit, 3 or 4, 0 for 3
+    uint32_t clip_mem_max;                       //< DMA memory all clips may use, 0 for default
     ws2811_channel_t channel[RPI_PWM_CHANNELS];
 } ws2811_t;
 
 
 int ws2811_init(ws2811_t *ws2811);               //< Initialize buffers/hardware
 void ws2811_fini(ws2811_t *ws2811);              //< Tear it all down
+int ws2811_reconfigure(ws2811_t *ws2811);        //< Apply new settings without a teardown
 int ws2811_render(ws2811_t *ws2811);             //< Send LEDs off to hardware
 int ws2811_wait(ws2811_t *ws2811);               //< Wait for DMA completion
+int ws2811_render_async(ws2811_t *ws2811);       //< Send LEDs off to hardware without blocking
+int ws2811_poll(ws2811_t *ws2811);               //< Handle completion, when the fd is readable
+int ws2811_get_fd(ws2811_t *ws2811);             //< Descriptor readable on DMA completion
+int ws2811_set_free_run(ws2811_t *ws2811, int enable);  //< Let the DMA repeat the last frame
+int ws2811_max_fps(ws2811_t *ws2811);            //< Highest refresh rate for the LED count
+int ws2811_set_fps(ws2811_t *ws2811, int fps);   //< Rate for ws2811_present, 0 for none
+int ws2811_present(ws2811_t *ws2811);            //< Render at the next frame deadline
+ws2811_clip_t *ws2811_clip_create(ws2811_t *ws2811, int frames, int fps);  //< Clip to pre-encode
+int ws2811_clip_capture(ws2811_t *ws2811, ws2811_clip_t *clip, int frame);  //< Encode LEDs into a frame
+int ws2811_clip_play(ws2811_t *ws2811, ws2811_clip_t *clip, int loop);  //< Let the DMA play a clip
+int ws2811_clip_stop(ws2811_t *ws2811);          //< Stop a playing clip after its current frame
+void ws2811_clip_free(ws2811_t *ws2811, ws2811_clip_t *clip);  //< Release a clip's DMA memory
+void ws2811_get_stats(ws2811_t *ws2811, ws2811_stats_t *stats);  //< Read render counters
+int ws2811_stats_export(ws2811_t *ws2811, int fd);  //< Write the counters as a JSON line
 
 #ifdef __cplusplus
 }